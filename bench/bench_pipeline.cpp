@@ -0,0 +1,168 @@
+/*
+ *
+ * Author:      Schuyler D. Smith
+ * Function:    bench_pipeline
+ * Purpose:     end-to-end and per-stage benchmarks on synthetic SmartChip exports
+ *
+ */
+
+
+#include "synthetic_smartchip.hpp"
+#include "scaclass.cpp"
+#include <lyra/lyra.hpp>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+
+struct Scenario {
+  std::string                   name;
+  SyntheticSmartchip::ChipSpec  spec;
+};
+
+std::vector<Scenario> default_scenarios() {
+  std::vector<Scenario> scenarios;
+  Scenario s;
+  s = Scenario{"panel24", {}};
+  s.spec.assays = 24;  s.spec.samples = 24; s.spec.replicates = 3; s.spec.files = 4;
+  scenarios.push_back(s);
+  s = Scenario{"panel96", {}};
+  s.spec.assays = 96;  s.spec.samples = 16; s.spec.replicates = 2; s.spec.files = 2;
+  scenarios.push_back(s);
+  s = Scenario{"panel384", {}};
+  s.spec.assays = 384; s.spec.samples = 3;  s.spec.replicates = 1; s.spec.files = 1;
+  scenarios.push_back(s);
+  s = Scenario{"dirty96", {}};
+  s.spec.assays = 96;  s.spec.samples = 16; s.spec.replicates = 2; s.spec.files = 2;
+  s.spec.nan_rate = 0.10; s.spec.undetermined_rate = 0.30;
+  scenarios.push_back(s);
+  return scenarios;
+}
+
+// Runs every chip of a scenario once and returns the summed wall time of
+// each profiled stage, plus "end_to_end" for the top-level stages.
+std::map<std::string, double> run_once(const std::vector<std::string>& files) {
+  SmartchipProfile::records.clear();
+  for (const auto& file : files) {
+    SmartchipArena::chip_scope arena;
+    SmartchipParameters sma(file);
+    SmartchipAnalyzer sma_report(sma);
+    sma_report.build_reports();
+  }
+  std::map<std::string, double> stage_ms;
+  for (const auto& r : SmartchipProfile::records) {
+    stage_ms[r.stage] += r.wall_ms;
+    if (r.depth == 0) {stage_ms["end_to_end"] += r.wall_ms;}
+  }
+  return stage_ms;
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  std::size_t n = values.size();
+  if (n == 0) {return 0;}
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+std::map<std::string, double> read_baseline(const std::string& path) {
+  std::map<std::string, double> baseline;
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  while (std::getline(file, line)) {
+    vstring fields = string_split(line, ',');
+    if (fields.size() < 5) {continue;}
+    baseline[fields[0] + "/" + fields[1]] = std::stod(fields[4]);
+  }
+  return baseline;
+}
+
+int main(int argc, char *argv[]) {
+  std::string work_dir = "/tmp/sca_bench";
+  std::string scenario_filter;
+  std::string csv_output;
+  std::string baseline_path;
+  int         repeat = 5;
+  bool        show_help = false;
+  auto cli
+    = lyra::help(show_help)
+    | lyra::opt( work_dir, "dir" )
+      ["-d"]["--dir"]
+      ("Scratch directory for generated chips and their reports.")
+    | lyra::opt( scenario_filter, "name" )
+      ["-s"]["--scenario"]
+      ("Only run the named scenario (panel24, panel96, panel384, dirty96).")
+    | lyra::opt( repeat, "5" )
+      ["-n"]["--repeat"]
+      ("Repetitions per scenario; the median is reported.")
+    | lyra::opt( csv_output, "file" )
+      ["-o"]["--csv"]
+      ("Write results as CSV for use as a later --baseline.")
+    | lyra::opt( baseline_path, "file" )
+      ["-b"]["--baseline"]
+      ("CSV from an earlier run; prints the change in throughput per stage.")
+  ;
+
+  auto result = cli.parse({ argc, argv });
+  if (!result) {
+    std::cerr << "Error in command line: " << result.message() << std::endl;
+    return 1;
+  }
+  if (show_help) {
+    std::cout << cli << "\n";
+    return 0;
+  }
+
+  std::map<std::string, double> baseline;
+  if (!baseline_path.empty()) {baseline = read_baseline(baseline_path);}
+
+  SmartchipProfile::enable();
+  std::ostringstream csv;
+  csv << "scenario,stage,wells,median_ms,wells_per_sec\n";
+  std::cout << std::left
+    << std::setw(10) << "scenario" << std::setw(14) << "stage"
+    << std::right << std::setw(8) << "wells" << std::setw(12) << "median_ms"
+    << std::setw(14) << "wells/sec" << (baseline.empty() ? "" : "  vs_baseline") << "\n";
+
+  for (const auto& scenario : default_scenarios()) {
+    if (!scenario_filter.empty() && scenario.name != scenario_filter) {continue;}
+    std::string dir = work_dir + "/" + scenario.name;
+    SmartchipInfra::make_dir(dir);
+    std::vector<std::string> files = SyntheticSmartchip::write_chips(dir, scenario.spec);
+    std::size_t wells = SyntheticSmartchip::wells_per_chip(scenario.spec) * files.size();
+
+    run_once(files);
+    std::map<std::string, std::vector<double> > samples;
+    for (int i = 0; i < repeat; ++i) {
+      for (const auto& it : run_once(files)) {samples[it.first].push_back(it.second);}
+    }
+    for (const std::string stage : {"ingest", "extract", "spatial", "melt", "regression", "copy_number", "reports", "transform", "end_to_end"}) {
+      if (samples.find(stage) == samples.end()) {continue;}
+      double ms   = median(samples[stage]);
+      double rate = ms > 0 ? wells / (ms / 1000.0) : 0;
+      std::cout << std::left
+        << std::setw(10) << scenario.name << std::setw(14) << stage
+        << std::right << std::setw(8) << wells
+        << std::setw(12) << std::fixed << std::setprecision(3) << ms
+        << std::setw(14) << std::setprecision(0) << rate;
+      auto base = baseline.find(scenario.name + "/" + stage);
+      if (base != baseline.end() && base->second > 0) {
+        std::cout << "  " << std::showpos << std::setprecision(1)
+          << 100.0 * (rate - base->second) / base->second << "%" << std::noshowpos;
+      }
+      std::cout << "\n";
+      csv << scenario.name << "," << stage << "," << wells << ","
+        << std::setprecision(3) << ms << "," << std::setprecision(0) << rate << "\n";
+    }
+  }
+
+  if (!csv_output.empty()) {
+    std::ofstream out(csv_output);
+    out << csv.str();
+  }
+	return(0);
+}
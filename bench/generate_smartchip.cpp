@@ -0,0 +1,73 @@
+/*
+ *
+ * Author:      Schuyler D. Smith
+ * Function:    generate_smartchip
+ * Purpose:     write synthetic SmartChip qPCR exports
+ *
+ */
+
+
+#include "synthetic_smartchip.hpp"
+#include "scaclass.cpp"
+#include <lyra/lyra.hpp>
+#include <iostream>
+#include <string>
+
+int main(int argc, char *argv[]) {
+  SyntheticSmartchip::ChipSpec spec;
+  std::string output = ".";
+  bool show_help = false;
+  auto cli
+    = lyra::help(show_help)
+    | lyra::opt( output, "dir" )
+      ["-o"]["--output"]
+      ("Directory to write synthetic_chip_<n>.csv files into.")
+    | lyra::opt( spec.assays, "24" )
+      ["-a"]["--assays"]
+      ("Number of assays per chip (1-384).")
+    | lyra::opt( spec.samples, "12" )
+      ["-s"]["--samples"]
+      ("Number of unknown samples per assay.")
+    | lyra::opt( spec.replicates, "2" )
+      ["-r"]["--replicates"]
+      ("Replicate wells per assay and sample.")
+    | lyra::opt( spec.dilutions, "5" )
+      ["-d"]["--dilutions"]
+      ("Number of standards in the dilution series (2-9).")
+    | lyra::opt( spec.nan_rate, "0.01" )
+      ["-n"]["--nan-rate"]
+      ("Fraction of Ct and Efficiency fields left empty.")
+    | lyra::opt( spec.undetermined_rate, "0.05" )
+      ["-u"]["--undetermined-rate"]
+      ("Fraction of sample wells reported as undetermined (Ct 45).")
+    | lyra::opt( spec.files, "1" )
+      ["-f"]["--files"]
+      ("Number of chip files to write.")
+    | lyra::opt( spec.seed, "42" )
+      ["--seed"]
+      ("Random seed; the same seed always produces the same files.")
+  ;
+
+  auto result = cli.parse({ argc, argv });
+  if (!result) {
+    std::cerr << "Error in command line: " << result.message() << std::endl;
+    return 1;
+  }
+  if (show_help) {
+    std::cout << cli << "\n";
+    return 0;
+  }
+
+  try {
+    SmartchipInfra::make_dir(output);
+    for (const auto& path : SyntheticSmartchip::write_chips(output, spec)) {
+      std::cout << path << "\n";
+    }
+  }
+  catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  std::cerr << SyntheticSmartchip::wells_per_chip(spec) << " wells per chip.\n";
+	return(0);
+}
@@ -0,0 +1,288 @@
+/*
+ *
+ * Author:      Schuyler D. Smith
+ * Function:    microbench_sds
+ * Purpose:     microbenchmarks for the maths_sds.hpp and maps_sds.hpp kernels
+ *
+ */
+
+
+// the allocs/op column needs the counting operator new in profile.hpp
+#define SCA_COUNT_ALLOCS
+
+#include "synthetic_smartchip.hpp"
+#include "scaclass.cpp"
+#include <lyra/lyra.hpp>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+// Keeps the optimizer from discarding a benchmarked result.
+template <typename T>
+void do_not_optimize(const T& value) {
+  #if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(&value) : "memory");
+  #else
+    static volatile const void* sink;
+    sink = &value;
+  #endif
+}
+
+struct BenchResult {
+  std::string name;
+  int         size;
+  double      nan_rate;
+  double      median_ns;
+  double      mad_ns;
+  double      min_ns;
+  double      allocs_per_op;
+};
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  std::size_t n = values.size();
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// Each sample times a batch sized to run for at least `min_batch_ns`, so the
+// clock resolution does not dominate; median and MAD over the samples keep a
+// single preempted batch from skewing the result.
+BenchResult measure(const std::string& name, int size, double nan_rate,
+  const std::function<void()>& op, int samples, double min_batch_ns) {
+  using clock = std::chrono::steady_clock;
+  long iterations = 1;
+  while (true) {
+    auto start = clock::now();
+    for (long i = 0; i < iterations; ++i) {op();}
+    double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    if (ns >= min_batch_ns || iterations >= (1L << 24)) {break;}
+    iterations *= 2;
+  }
+  std::vector<double> per_op;
+  unsigned long long allocs_before = SmartchipProfile::allocations;
+  for (int s = 0; s < samples; ++s) {
+    auto start = clock::now();
+    for (long i = 0; i < iterations; ++i) {op();}
+    per_op.push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count() / iterations);
+  }
+  unsigned long long allocs = SmartchipProfile::allocations - allocs_before;
+
+  double med = median(per_op);
+  std::vector<double> deviations;
+  for (double v : per_op) {deviations.push_back(std::fabs(v - med));}
+  return BenchResult{name, size, nan_rate, med, median(deviations),
+    *std::min_element(per_op.begin(), per_op.end()),
+    static_cast<double>(allocs) / (static_cast<double>(iterations) * samples)};
+}
+
+vdouble random_values(int n, double nan_rate, std::mt19937_64& rng) {
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  vdouble values(n);
+  for (auto& v : values) {v = unit(rng) < nan_rate ? NAN : 15 + 25 * unit(rng);}
+  return values;
+}
+
+std::string random_csv_line(int fields, std::mt19937_64& rng) {
+  std::uniform_int_distribution<int> length(1, 12);
+  std::string line;
+  for (int i = 0; i < fields; ++i) {
+    if (i) {line += ',';}
+    line += std::string(length(rng), 'a' + i % 26);
+  }
+  return line;
+}
+
+vstring random_ids(int n, std::mt19937_64& rng) {
+  std::uniform_int_distribution<int> pick(0, 383);
+  vstring ids;
+  for (int i = 0; i < n; ++i) {
+    ids.push_back(SyntheticSmartchip::assay_name(pick(rng)) + "STD" + std::to_string(i % 10));
+  }
+  return ids;
+}
+
+um_str_vdbl random_groups(int groups, int replicates, double nan_rate, std::mt19937_64& rng) {
+  um_str_vdbl map;
+  for (int g = 0; g < groups; ++g) {
+    map["group" + std::to_string(g)] = random_values(replicates, nan_rate, rng);
+  }
+  return map;
+}
+
+std::map<std::string, double> read_baseline(const std::string& path) {
+  std::map<std::string, double> baseline;
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  while (std::getline(file, line)) {
+    vstring fields = string_split(line, ',');
+    if (fields.size() < 4) {continue;}
+    baseline[fields[0] + "/" + fields[1] + "/" + fields[2]] = std::stod(fields[3]);
+  }
+  return baseline;
+}
+
+int main(int argc, char *argv[]) {
+  std::string filter;
+  std::string csv_output;
+  std::string baseline_path;
+  std::string work_dir = "/tmp/sca_microbench";
+  double      tolerance = 0.25;
+  int         samples = 15;
+  double      min_batch_ms = 2;
+  bool        show_help = false;
+  auto cli
+    = lyra::help(show_help)
+    | lyra::opt( filter, "name" )
+      ["-f"]["--filter"]
+      ("Only run benchmarks whose name contains this string.")
+    | lyra::opt( samples, "15" )
+      ["-n"]["--samples"]
+      ("Timed batches per benchmark.")
+    | lyra::opt( min_batch_ms, "2" )
+      ["--batch-ms"]
+      ("Minimum duration of one timed batch, in milliseconds.")
+    | lyra::opt( csv_output, "file" )
+      ["-o"]["--csv"]
+      ("Write results as CSV for use as a later --baseline.")
+    | lyra::opt( baseline_path, "file" )
+      ["-b"]["--baseline"]
+      ("CSV from an earlier run; exit non-zero if any median regresses beyond --tolerance.")
+    | lyra::opt( tolerance, "0.25" )
+      ["-t"]["--tolerance"]
+      ("Allowed fractional slowdown against the baseline.")
+    | lyra::opt( work_dir, "dir" )
+      ["-d"]["--dir"]
+      ("Scratch directory for the CSV files read by the map benchmarks.")
+  ;
+
+  auto result = cli.parse({ argc, argv });
+  if (!result) {
+    std::cerr << "Error in command line: " << result.message() << std::endl;
+    return 1;
+  }
+  if (show_help) {
+    std::cout << cli << "\n";
+    return 0;
+  }
+
+  SmartchipProfile::count_allocations();
+
+  const std::vector<int>    sizes     = {8, 64, 512, 4096};
+  const std::vector<double> nan_rates = {0.0, 0.1, 0.5};
+  const double              batch_ns  = min_batch_ms * 1.0e6;
+  std::mt19937_64           rng(42);
+  std::vector<BenchResult>  results;
+
+  auto wanted = [&](const std::string& name) {return filter.empty() || name.find(filter) != std::string::npos;};
+  auto run = [&](const std::string& name, int size, double nan_rate, const std::function<void()>& op) {
+    if (!wanted(name)) {return;}
+    results.push_back(measure(name, size, nan_rate, op, samples, batch_ns));
+    const BenchResult& r = results.back();
+    std::cout << std::left << std::setw(26) << r.name
+      << std::right << std::setw(6) << r.size
+      << std::setw(6) << std::setprecision(2) << std::fixed << r.nan_rate
+      << std::setw(14) << std::setprecision(1) << r.median_ns
+      << std::setw(12) << r.mad_ns
+      << std::setw(14) << r.min_ns
+      << std::setw(12) << std::setprecision(2) << r.allocs_per_op << "\n";
+  };
+
+  std::cout << std::left << std::setw(26) << "benchmark" << std::right << std::setw(6) << "n"
+    << std::setw(6) << "nan" << std::setw(14) << "median_ns/op" << std::setw(12) << "mad_ns"
+    << std::setw(14) << "min_ns/op" << std::setw(12) << "allocs/op" << "\n";
+
+  for (int n : sizes) {
+    std::string line = random_csv_line(n, rng);
+    run("string_split", n, 0, [&]() {do_not_optimize(string_split(line, ','));});
+  }
+
+  for (int n : sizes) {
+    for (double nan_rate : nan_rates) {
+      vdouble x = random_values(n, nan_rate, rng);
+      vdouble y = random_values(n, nan_rate, rng);
+      run("rm_nan",             n, nan_rate, [&]() {do_not_optimize(rm_nan(x));});
+      run("mean",               n, nan_rate, [&]() {do_not_optimize(mean(x));});
+      run("variance",           n, nan_rate, [&]() {do_not_optimize(variance(x));});
+      run("sd",                 n, nan_rate, [&]() {do_not_optimize(sd(x));});
+      run("lm",                 n, nan_rate, [&]() {do_not_optimize(lm(x, y));});
+      run("coef_determination", n, nan_rate, [&]() {do_not_optimize(coef_determination(x, y));});
+      robust_workspace workspace;
+      run("robust_lm_huber",    n, nan_rate, [&]() {do_not_optimize(robust_lm(x, y, robust_weight::huber, workspace));});
+      run("robust_lm_tukey",    n, nan_rate, [&]() {do_not_optimize(robust_lm(x, y, robust_weight::tukey, workspace));});
+    }
+  }
+
+  // um_* run over n groups of four replicates, the common SmartChip layout.
+  for (int n : sizes) {
+    for (double nan_rate : nan_rates) {
+      um_str_vdbl groups = random_groups(n, 4, nan_rate, rng);
+      run("um_mean", n, nan_rate, [&]() {do_not_optimize(um_mean(groups));});
+      run("um_sd",   n, nan_rate, [&]() {do_not_optimize(um_sd(groups));});
+    }
+  }
+
+  for (int n : sizes) {
+    vstring ids = random_ids(n, rng);
+    run("natural_sort", n, 0, [&]() {
+      vstring sorted = ids;
+      natural_sort(sorted);
+      do_not_optimize(sorted);
+    });
+  }
+
+  // map_variable_vec_numeric reads a file, so n is the number of wells.
+  if (wanted("map_variable_vec_numeric")) {
+    SmartchipInfra::make_dir(work_dir);
+    for (double nan_rate : nan_rates) {
+      SyntheticSmartchip::ChipSpec spec;
+      spec.assays = 48; spec.samples = 8; spec.replicates = 4; spec.nan_rate = nan_rate;
+      std::string path = work_dir + "/microbench_chip.csv";
+      std::ofstream out(path);
+      SyntheticSmartchip::write_chip(out, spec, 0);
+      out.close();
+      int wells = static_cast<int>(SyntheticSmartchip::wells_per_chip(spec));
+      run("map_variable_vec_numeric", wells, nan_rate, [&]() {
+        do_not_optimize(map_variable_vec_numeric(path, {"Assay", "Sample"}, {"Ct"}));
+      });
+    }
+  }
+
+  if (!csv_output.empty()) {
+    std::ofstream out(csv_output);
+    out << std::fixed;
+    out << "benchmark,n,nan_rate,median_ns,mad_ns,min_ns,allocs_per_op\n";
+    for (const auto& r : results) {
+      out << r.name << "," << r.size << "," << std::setprecision(2) << r.nan_rate << ","
+        << std::setprecision(1) << r.median_ns << "," << r.mad_ns << "," << r.min_ns << ","
+        << std::setprecision(2) << r.allocs_per_op << "\n";
+    }
+  }
+
+  int regressions = 0;
+  if (!baseline_path.empty()) {
+    std::map<std::string, double> baseline = read_baseline(baseline_path);
+    for (const auto& r : results) {
+      std::ostringstream key;
+      key << r.name << "/" << r.size << "/" << std::fixed << std::setprecision(2) << r.nan_rate;
+      auto base = baseline.find(key.str());
+      if (base == baseline.end() || base->second <= 0) {continue;}
+      double change = (r.median_ns - base->second) / base->second;
+      if (change > tolerance) {
+        ++regressions;
+        std::cerr << "REGRESSION " << key.str() << ": " << std::setprecision(1)
+          << base->second << " -> " << r.median_ns << " ns/op ("
+          << std::showpos << 100 * change << "%)" << std::noshowpos << "\n";
+      }
+    }
+  }
+	return(regressions ? 1 : 0);
+}
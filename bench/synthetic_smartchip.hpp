@@ -0,0 +1,156 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: synthesize SmartChip exports for benchmarking
+ *
+ */
+
+#ifndef SYNTHETIC_SMARTCHIP
+#define SYNTHETIC_SMARTCHIP
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+#include <stdexcept>
+
+// Layout follows the SmartChip export (see misc/ReplacementCurves.csv):
+//   Row,Column,Assay,Sample,Conc,Ct,Tm,Efficiency,Flags
+// Wells are dispensed assay-major across a 72x72 chip, one block of
+// samples x replicates per assay. Standards are STD1..STDn where the
+// trailing digit is the log10 abundance the analyzer reads back.
+namespace SyntheticSmartchip {
+  const int chip_rows     = 72;
+  const int chip_columns  = 72;
+
+  struct ChipSpec {
+    int           assays            = 24;
+    int           samples           = 12;
+    int           replicates        = 2;
+    int           dilutions         = 5;
+    double        nan_rate          = 0.01;
+    double        undetermined_rate = 0.05;
+    int           files             = 1;
+    unsigned long seed              = 42;
+    std::string   standard_id       = "STD";
+    std::string   non_template_id   = "NTC";
+    std::string   negative_id       = "NEG";
+  };
+
+  std::size_t wells_per_chip(const ChipSpec& spec) {
+    return static_cast<std::size_t>(spec.assays)
+      * (spec.samples + spec.dilutions + 2) * spec.replicates;
+  }
+
+  void validate(const ChipSpec& spec) {
+    if (spec.assays < 1 || spec.assays > 384) {
+      throw std::invalid_argument("assays must be between 1 and 384.");
+    }
+    if (spec.dilutions < 2 || spec.dilutions > 9) {
+      throw std::invalid_argument("dilutions must be between 2 and 9 (single-digit standard IDs).");
+    }
+    if (spec.samples < 0 || spec.replicates < 1 || spec.files < 1) {
+      throw std::invalid_argument("samples, replicates and files must be positive.");
+    }
+    if (spec.nan_rate < 0 || spec.nan_rate > 1 || spec.undetermined_rate < 0 || spec.undetermined_rate > 1) {
+      throw std::invalid_argument("nan and undetermined rates must be in [0, 1].");
+    }
+    const std::size_t wells = static_cast<std::size_t>(chip_rows) * chip_columns;
+    if (wells_per_chip(spec) > wells) {
+      throw std::invalid_argument("assays x (samples + dilutions + 2) x replicates is "
+        + std::to_string(wells_per_chip(spec)) + " wells; a chip has " + std::to_string(wells) + ".");
+    }
+  }
+
+  std::string assay_name(int i) {
+    static const char* genes[] = {"16S", "AOA", "AOB", "ITS", "Myco", "Soy16", "bpp", "comaA",
+      "comaB", "gcd", "nifH", "nirK", "nirS", "nosZI", "phoD", "phoN"};
+    std::string name = genes[i % 16];
+    if (i >= 16) {name += "_" + std::to_string(i / 16);}
+    return name;
+  }
+
+  std::vector<std::string> sample_names(const ChipSpec& spec) {
+    std::vector<std::string> names;
+    for (int d = 1; d <= spec.dilutions; ++d) {names.push_back(spec.standard_id + std::to_string(d));}
+    names.push_back(spec.non_template_id);
+    names.push_back(spec.negative_id);
+    for (int s = 1; s <= spec.samples; ++s) {names.push_back("S" + std::to_string(s));}
+    return names;
+  }
+
+  std::string fixed(double value, int precision) {
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(precision);
+    out << value;
+    return out.str();
+  }
+
+  void write_chip(std::ostream& out, const ChipSpec& spec, int file_index) {
+    std::mt19937_64 rng(spec.seed + 7919 * file_index);
+    std::uniform_real_distribution<double>  unit(0.0, 1.0);
+    std::normal_distribution<double>        noise(0.0, 1.0);
+    std::vector<std::string>                samples = sample_names(spec);
+
+    out << "Row,Column,Assay,Sample,Conc,Ct,Tm,Efficiency,Flags\n";
+    std::size_t well = 0;
+    for (int a = 0; a < spec.assays; ++a) {
+      double intercept  = 34 + 4 * unit(rng);
+      double slope      = -3.6 + 0.5 * unit(rng);
+      double melt       = 78 + 12 * unit(rng);
+      std::string assay = assay_name(a);
+      for (std::size_t s = 0; s < samples.size(); ++s) {
+        const std::string& sample = samples[s];
+        bool standard = s < static_cast<std::size_t>(spec.dilutions);
+        bool control  = !standard && s < static_cast<std::size_t>(spec.dilutions + 2);
+        double log_abundance = standard ? s + 1 : 1 + (spec.dilutions - 1) * unit(rng);
+        for (int r = 0; r < spec.replicates; ++r, ++well) {
+          std::string ct, tm, efficiency, flags;
+          double efficiency_value = 1.9 + 0.08 * noise(rng);
+          if (control || unit(rng) < spec.undetermined_rate) {
+            ct    = "45";
+            flags = "NoAmplification";
+          } else {
+            ct = fixed(intercept + slope * log_abundance + 0.25 * noise(rng), 2);
+            tm = fixed(melt + 0.3 * noise(rng), 2);
+            efficiency = fixed(efficiency_value, 2);
+            if (efficiency_value < 1.7) {flags = "LowEfficiency";}
+          }
+          if (unit(rng) < spec.nan_rate) {ct.clear();}
+          if (unit(rng) < spec.nan_rate) {efficiency.clear();}
+          out << well / chip_columns + 1 << ","
+            << well % chip_columns + 1 << ","
+            << assay << ","
+            << sample << ","
+            << -1 << ","
+            << ct << ","
+            << tm << ","
+            << efficiency << ","
+            << flags << "\n";
+        }
+      }
+    }
+  }
+
+  std::vector<std::string> write_chips(const std::string& directory, const ChipSpec& spec) {
+    validate(spec);
+    std::vector<std::string> paths;
+    for (int f = 0; f < spec.files; ++f) {
+      std::string path = directory + "/synthetic_chip_" + std::to_string(f + 1) + ".csv";
+      std::ofstream out(path);
+      if (!out.is_open()) {
+        throw std::invalid_argument("Error: unable to write '" + path + "'.");
+      }
+      write_chip(out, spec, f);
+      paths.push_back(path);
+    }
+    return paths;
+  }
+}
+
+#endif // SYNTHETIC_SMARTCHIP
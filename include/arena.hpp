@@ -0,0 +1,100 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: per-chip arena for short-lived working storage
+ *
+ */
+
+#ifndef ARENA
+#define ARENA
+
+#include <vector>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+// The chip's CSV rows and the working vectors and maps that only live while
+// a chip is processed (the spatial and melt passes, report statistics) are
+// taken from a monotonic arena instead of the heap: an allocation is a
+// pointer bump and a deallocation does nothing. The per-group results of
+// extract and transform (group_Ct and the other um_str_* maps) stay on the
+// heap, as they are the plain std maps every module reads. Each worker
+// thread owns one arena. A chip_scope marks one chip; when the outermost
+// scope closes the arena is released in one step, and its buffer is kept
+// for the thread's next chip, grown to what the last chip needed so later
+// chips seldom leave it.
+//
+// Outside a chip_scope (or on threads without one, e.g. bootstrap workers)
+// resource() is the ordinary heap, so the same code runs either way.
+// Storage taken from the arena must not outlive the chip_scope.
+namespace SmartchipArena {
+  // heap upstream that remembers how much the arena asked it for
+  class counting_resource : public std::pmr::memory_resource {
+    public:
+      std::size_t requested = 0;
+
+    private:
+      void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        requested += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+      }
+      void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+      }
+      bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+      }
+  };
+
+  class worker_arena {
+    public:
+      static const std::size_t initial_size = 1 << 20;
+
+      worker_arena() : buffer(initial_size) {reset();}
+
+      std::pmr::memory_resource* get() {return arena.get();}
+
+      void release() {
+        arena->release();
+        if (upstream.requested) {
+          buffer.assign(buffer.size() + upstream.requested, std::byte());
+          upstream.requested = 0;
+          reset();
+        }
+      }
+
+    private:
+      std::vector<std::byte>                                buffer;
+      counting_resource                                     upstream;
+      std::unique_ptr<std::pmr::monotonic_buffer_resource>  arena;
+
+      void reset() {
+        arena.reset(new std::pmr::monotonic_buffer_resource(buffer.data(), buffer.size(), &upstream));
+      }
+  };
+
+  thread_local int depth = 0;
+
+  worker_arena& thread_arena() {
+    thread_local worker_arena arena;
+    return arena;
+  }
+
+  std::pmr::memory_resource* resource() {
+    return depth > 0 ? thread_arena().get() : std::pmr::get_default_resource();
+  }
+
+  class chip_scope {
+    public:
+      chip_scope() {++depth;}
+      ~chip_scope() {if (--depth == 0) {thread_arena().release();}}
+      chip_scope(const chip_scope&) = delete;
+      chip_scope& operator=(const chip_scope&) = delete;
+  };
+
+  template <class T>
+  using vector = std::pmr::vector<T>;
+}
+
+#endif // ARENA
@@ -0,0 +1,200 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: bootstrap intervals for standard curves and copy numbers
+ *
+ */
+
+#ifndef BOOTSTRAP
+#define BOOTSTRAP
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+#include "scaclass.cpp"
+#include "thread_pool.hpp"
+
+// Resamples each assay's standard points with replacement, refits the
+// curve and carries every refit through to the groups' mean copy numbers.
+// A resample is drawn as per-point counts used as weights, so a refit is a
+// single weighted_lm() pass over the original points with no copying.
+// Robust fits keep their final weights, which scale the counts. Each assay
+// has its own random stream seeded from (seed, assay index), so the
+// intervals do not depend on the number of threads.
+namespace SmartchipBootstrap {
+  struct interval {
+    double lower = std::numeric_limits<double>::quiet_NaN();
+    double upper = std::numeric_limits<double>::quiet_NaN();
+  };
+
+  struct assay_intervals {
+    interval intercept;
+    interval slope;
+    interval efficiency;
+  };
+
+  struct intervals {
+    std::unordered_map<std::string, assay_intervals> assays;
+    std::unordered_map<std::string, interval>        groups;
+  };
+
+  // equal-tailed percentile interval; non-finite resamples are dropped
+  interval percentile_interval(vdouble& values, double level) {
+    values.erase(std::remove_if(values.begin(), values.end(),
+      [](double v) {return !std::isfinite(v);}), values.end());
+    interval bounds;
+    if (values.empty()) {return bounds;}
+    std::sort(values.begin(), values.end());
+    auto quantile = [&](double p) {
+      double h = p * (values.size() - 1);
+      std::size_t lo = static_cast<std::size_t>(std::floor(h));
+      std::size_t hi = std::min(lo + 1, values.size() - 1);
+      return values[lo] + (h - lo) * (values[hi] - values[lo]);
+    };
+    bounds.lower = quantile((1 - level) / 2);
+    bounds.upper = quantile(1 - (1 - level) / 2);
+    return bounds;
+  }
+
+  void resample_assay(
+    const vdouble&                      X,
+    const vdouble&                      Y,
+    const vdouble&                      base_weights,
+    const std::vector<vdouble>&         group_Cts,
+    float                               coefficient,
+    unsigned int                        resamples,
+    std::mt19937_64&                    rng,
+    double                              level,
+    assay_intervals&                    assay_out,
+    std::vector<interval>&              group_out
+  ) {
+    std::vector<std::size_t> usable;
+    for (std::size_t i = 0; i < X.size(); ++i) {
+      double w = base_weights.empty() ? 1.0 : base_weights[i];
+      if (!std::isnan(X[i]) && !std::isnan(Y[i]) && w > 0) {usable.push_back(i);}
+    }
+    group_out.assign(group_Cts.size(), interval());
+    if (usable.size() < 3) {return;}
+
+    std::uniform_int_distribution<std::size_t> pick(0, usable.size() - 1);
+    vdouble W(X.size());
+    vdouble intercepts(resamples), slopes(resamples), efficiencies(resamples);
+    std::vector<vdouble> copies(group_Cts.size(), vdouble(resamples));
+    for (unsigned int r = 0; r < resamples; ++r) {
+      std::fill(W.begin(), W.end(), 0.0);
+      for (std::size_t k = 0; k < usable.size(); ++k) {
+        std::size_t i = usable[pick(rng)];
+        W[i] += base_weights.empty() ? 1.0 : base_weights[i];
+      }
+      robust_fit fit = weighted_lm(X, Y, W);
+      intercepts[r]   = fit.a;
+      slopes[r]       = fit.b;
+      efficiencies[r] = std::pow(10, -1/fit.b);
+      for (std::size_t g = 0; g < group_Cts.size(); ++g) {
+        double sum = 0;
+        int    n   = 0;
+        for (double Ct : group_Cts[g]) {
+          if (std::isnan(Ct)) {continue;}
+          sum += std::pow(10, (Ct - fit.a)/fit.b);
+          ++n;
+        }
+        copies[g][r] = n ? coefficient * sum / n : std::numeric_limits<double>::quiet_NaN();
+      }
+    }
+    assay_out.intercept  = percentile_interval(intercepts, level);
+    assay_out.slope      = percentile_interval(slopes, level);
+    assay_out.efficiency = percentile_interval(efficiencies, level);
+    for (std::size_t g = 0; g < group_Cts.size(); ++g) {
+      group_out[g] = percentile_interval(copies[g], level);
+    }
+  }
+
+  intervals run(
+    const SmartchipParameters&  params,
+    const ExtractResult&        extracted,
+    const TransformResult&      transformed,
+    unsigned int                resamples,
+    unsigned long long          seed,
+    unsigned int                threads,
+    double                      level = 0.95
+  ) {
+    SmartchipProfile::ScopedStage stage(params.chip_name, "bootstrap");
+    const vstring& assays = extracted.assays;
+    std::vector<assay_intervals>        assay_out(assays.size());
+    std::vector<std::vector<interval> > group_out(assays.size());
+    {
+      ThreadPool pool(threads);
+      for (std::size_t a = 0; a < assays.size(); ++a) {
+        pool.submit([&, a]() {
+          const std::string& assay = assays[a];
+          const vstring& groups = um_at(extracted.assay_group, assay);
+          // wells the spatial model excluded from the copy numbers are left
+          // out of every resample too
+          std::vector<vdouble> group_Cts;
+          for (const auto& group : groups) {
+            vdouble Cts = um_at(extracted.group_Ct, group);
+            for (int replicate : um_at(extracted.spatial.excluded_replicates, group)) {
+              Cts[replicate] = std::numeric_limits<double>::quiet_NaN();
+            }
+            group_Cts.push_back(std::move(Cts));
+          }
+          auto magnitude = params.gene_magnitudes.find(assay);
+          float coefficient = magnitude != params.gene_magnitudes.end() ? magnitude->second : 1;
+          std::seed_seq seeds{static_cast<unsigned int>(seed), static_cast<unsigned int>(seed >> 32),
+            static_cast<unsigned int>(a)};
+          std::mt19937_64 rng(seeds);
+          resample_assay(um_at(transformed.curve_log_abundance, assay), um_at(transformed.curve_Ct, assay),
+            um_at(transformed.curve_weight, assay), group_Cts, coefficient, resamples, rng, level,
+            assay_out[a], group_out[a]);
+        });
+      }
+      pool.wait();
+    }
+    intervals result;
+    for (std::size_t a = 0; a < assays.size(); ++a) {
+      result.assays[assays[a]] = assay_out[a];
+      const vstring& groups = um_at(extracted.assay_group, assays[a]);
+      for (std::size_t g = 0; g < groups.size(); ++g) {result.groups[groups[g]] = group_out[a][g];}
+    }
+    return result;
+  }
+
+  void write_report(
+    const std::string&      output,
+    const ExtractResult&    extracted,
+    const TransformResult&  transformed,
+    const intervals&        bounds
+  ) {
+    std::unique_ptr<std::ostream> bootstrap_stream = SdsCompress::open_output(output + "_bootstrap_CI.csv");
+    std::ostream& bootstrap_file = *bootstrap_stream;
+    bootstrap_file
+      << "Assay,Sample,Mean_Copy_N,CopyN_lower,CopyN_upper,"
+      << "STD_Efficiency,Efficiency_lower,Efficiency_upper,"
+      << "Slope,Slope_lower,Slope_upper,Intercept,Intercept_lower,Intercept_upper\n";
+    for (const auto& group : extracted.groups) {
+      const std::string& assay  = um_at(extracted.group_assay, group);
+      const interval& copy_N    = um_at(bounds.groups, group);
+      const assay_intervals& ci = um_at(bounds.assays, assay);
+      const std::pair<double, double>& fit = um_at(transformed.regression_map, assay);
+      bootstrap_file
+        << assay << ","
+        << um_at(extracted.group_sample, group) << ","
+        << mean(um_at(transformed.group_copyN, group)) << ","
+        << copy_N.lower << "," << copy_N.upper << ","
+        << um_at(transformed.std_efficiency_map, assay) << ","
+        << ci.efficiency.lower << "," << ci.efficiency.upper << ","
+        << fit.second << "," << ci.slope.lower << "," << ci.slope.upper << ","
+        << fit.first << "," << ci.intercept.lower << "," << ci.intercept.upper
+        << "\n";
+    }
+  }
+}
+
+#endif // BOOTSTRAP
@@ -0,0 +1,480 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ *
+ */
+
+#ifndef COMPRESS_SDS
+#define COMPRESS_SDS
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+#include <zlib.h>
+#ifdef SCA_WITH_ZSTD
+  #include <zstd.h>
+#endif
+
+// Transparent gzip/zstd streams. open_input() sniffs the file's magic bytes
+// and, for compressed files, returns an istream whose buffer is filled by a
+// background thread, so decompression overlaps with parsing; corrupt or
+// truncated data is thrown to the reader as std::runtime_error once the
+// intact part has been read. open_output() compresses according to the
+// format requested (or the process default).
+namespace SdsCompress {
+  enum class Format {none, gzip, zstd};
+
+  Format output_format = Format::none;
+
+  Format parse_format(const std::string& name) {
+    if (name.empty() || name == "none")        {return Format::none;}
+    if (name == "gz" || name == "gzip")        {return Format::gzip;}
+    if (name == "zst" || name == "zstd") {
+      #ifndef SCA_WITH_ZSTD
+        throw std::invalid_argument("zstd support not built in; rebuild with ZSTD=1.");
+      #endif
+      return Format::zstd;
+    }
+    throw std::invalid_argument("unknown compression '" + name + "' (use none, gz or zst).");
+  }
+
+  std::string extension(Format format) {
+    switch (format) {
+      case Format::gzip: return ".gz";
+      case Format::zstd: return ".zst";
+      default:           return "";
+    }
+  }
+
+  bool has_extension(const std::string& path, const std::string& ext) {
+    return path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+  }
+
+  std::string strip_extension(const std::string& path) {
+    for (const std::string ext : {".gz", ".zst"}) {
+      if (has_extension(path, ext)) {return path.substr(0, path.size() - ext.size());}
+    }
+    return path;
+  }
+
+  // reads the magic bytes and rewinds, so the same handle can be reused
+  Format detect(std::ifstream& file) {
+    unsigned char magic[4] = {0, 0, 0, 0};
+    file.read(reinterpret_cast<char*>(magic), 4);
+    std::streamsize n = file.gcount();
+    file.clear();
+    file.seekg(0);
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {return Format::gzip;}
+    if (n == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+      return Format::zstd;
+    }
+    return Format::none;
+  }
+
+  class decompress_streambuf : public std::streambuf {
+    public:
+      decompress_streambuf(const std::string& path, std::ifstream&& opened, Format format)
+      : path(path), format(format), file(std::move(opened)) {
+        #ifndef SCA_WITH_ZSTD
+          if (format == Format::zstd) {
+            throw std::invalid_argument("'" + path + "' is zstd-compressed; rebuild with ZSTD=1.");
+          }
+        #endif
+        producer = std::thread([this]() {produce();});
+      }
+      ~decompress_streambuf() {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+        }
+        space_ready.notify_all();
+        producer.join();
+      }
+
+    protected:
+      int_type underflow() override {
+        if (gptr() < egptr()) {return traits_type::to_int_type(*gptr());}
+        std::unique_lock<std::mutex> lock(mutex);
+        chunk_ready.wait(lock, [this]() {return !chunks.empty() || finished;});
+        if (chunks.empty()) {
+          // the reading stream sets badbit and rethrows, so a damaged file
+          // fails its chip instead of reading as a shorter table
+          if (!error.empty()) {throw std::runtime_error(error);}
+          return traits_type::eof();
+        }
+        current = std::move(chunks.front());
+        chunks.pop_front();
+        lock.unlock();
+        space_ready.notify_one();
+        setg(current.data(), current.data(), current.data() + current.size());
+        return traits_type::to_int_type(*gptr());
+      }
+
+    private:
+      static const std::size_t  chunk_size = 1 << 18;
+      static const std::size_t  max_chunks = 8;
+      std::string               path;
+      Format                    format;
+      std::ifstream             file;
+      std::thread               producer;
+      std::mutex                mutex;
+      std::condition_variable   chunk_ready;
+      std::condition_variable   space_ready;
+      std::deque<std::vector<char> > chunks;
+      std::vector<char>         current;
+      bool                      finished = false;
+      bool                      stopping = false;
+      std::string               error;
+
+      // returns false once the reader has gone away
+      bool push(std::vector<char>& chunk) {
+        if (chunk.empty()) {return true;}
+        std::unique_lock<std::mutex> lock(mutex);
+        space_ready.wait(lock, [this]() {return chunks.size() < max_chunks || stopping;});
+        if (stopping) {return false;}
+        chunks.push_back(std::move(chunk));
+        lock.unlock();
+        chunk_ready.notify_one();
+        chunk = std::vector<char>();
+        return true;
+      }
+
+      void finish(const std::string& message) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = message;
+        finished = true;
+        chunk_ready.notify_all();
+      }
+
+      void produce() {
+        std::string message;
+        if (format == Format::gzip) {message = inflate_gzip();}
+        #ifdef SCA_WITH_ZSTD
+          if (format == Format::zstd) {message = decompress_zstd();}
+        #endif
+        finish(message);
+      }
+
+      std::string inflate_gzip() {
+        std::vector<char> in(chunk_size);
+        std::vector<char> out;
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        if (inflateInit2(&zs, 15 + 32) != Z_OK) {return "unable to initialise zlib.";}
+        int ret = Z_OK;
+        bool in_member = true;
+        while (file) {
+          file.read(in.data(), in.size());
+          zs.next_in  = reinterpret_cast<Bytef*>(in.data());
+          zs.avail_in = static_cast<uInt>(file.gcount());
+          while (zs.avail_in > 0) {
+            std::size_t used = out.size();
+            out.resize(chunk_size);
+            zs.next_out  = reinterpret_cast<Bytef*>(out.data() + used);
+            zs.avail_out = static_cast<uInt>(chunk_size - used);
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END) {
+              inflateEnd(&zs);
+              return "corrupt gzip data in '" + path + "'.";
+            }
+            out.resize(chunk_size - zs.avail_out);
+            // concatenated gzip members are read as one stream
+            in_member = ret != Z_STREAM_END;
+            if (!in_member) {inflateReset(&zs);}
+            if (out.size() == chunk_size && !push(out)) {inflateEnd(&zs); return "";}
+          }
+        }
+        inflateEnd(&zs);
+        if (file.bad()) {return "could not read '" + path + "'.";}
+        if (in_member)  {return "truncated gzip data in '" + path + "'.";}
+        push(out);
+        return "";
+      }
+
+      #ifdef SCA_WITH_ZSTD
+      std::string decompress_zstd() {
+        std::vector<char> in(chunk_size);
+        std::vector<char> out;
+        ZSTD_DCtx* dctx = ZSTD_createDCtx();
+        if (!dctx) {return "unable to initialise zstd.";}
+        std::size_t ret = 1;
+        while (file) {
+          file.read(in.data(), in.size());
+          ZSTD_inBuffer input = {in.data(), static_cast<std::size_t>(file.gcount()), 0};
+          while (input.pos < input.size) {
+            std::size_t used = out.size();
+            out.resize(chunk_size);
+            ZSTD_outBuffer output = {out.data() + used, chunk_size - used, 0};
+            ret = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(ret)) {
+              ZSTD_freeDCtx(dctx);
+              return "corrupt zstd data in '" + path + "'.";
+            }
+            out.resize(used + output.pos);
+            if (out.size() == chunk_size && !push(out)) {ZSTD_freeDCtx(dctx); return "";}
+          }
+        }
+        ZSTD_freeDCtx(dctx);
+        if (file.bad()) {return "could not read '" + path + "'.";}
+        // a frame still being decoded when the file ends was cut off
+        if (ret != 0)   {return "truncated zstd data in '" + path + "'.";}
+        push(out);
+        return "";
+      }
+      #endif
+  };
+
+  class compress_streambuf : public std::streambuf {
+    public:
+      compress_streambuf(const std::string& path, Format format)
+      : format(format), file(path, std::ios::binary), buffer(chunk_size) {
+        #ifndef SCA_WITH_ZSTD
+          if (format == Format::zstd) {
+            throw std::invalid_argument("zstd output requested; rebuild with ZSTD=1.");
+          }
+        #endif
+        if (format == Format::gzip) {
+          std::memset(&zs, 0, sizeof(zs));
+          if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            file.close();
+            std::remove(path.c_str());
+            throw std::runtime_error("unable to initialise zlib for '" + path + "'.");
+          }
+        }
+        #ifdef SCA_WITH_ZSTD
+          if (format == Format::zstd) {cctx = ZSTD_createCCtx();}
+        #endif
+        setp(buffer.data(), buffer.data() + buffer.size());
+      }
+      ~compress_streambuf() {
+        finish();
+        if (format == Format::gzip) {deflateEnd(&zs);}
+        #ifdef SCA_WITH_ZSTD
+          if (format == Format::zstd) {ZSTD_freeCCtx(cctx);}
+        #endif
+      }
+      // ends the compressed stream and closes the file; false on a write error
+      bool finish() {
+        if (!finished) {
+          finished = true;
+          compress(true);
+          file.close();
+        }
+        return !file.fail();
+      }
+      bool is_open() const {return file.is_open();}
+      bool good() const {return file.good();}
+
+    protected:
+      int_type overflow(int_type c) override {
+        if (!compress(false)) {return traits_type::eof();}
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+          *pptr() = traits_type::to_char_type(c);
+          pbump(1);
+        }
+        return traits_type::not_eof(c);
+      }
+      int sync() override {return compress(false) ? 0 : -1;}
+
+    private:
+      static const std::size_t  chunk_size = 1 << 18;
+      Format                    format;
+      bool                      finished = false;
+      std::ofstream             file;
+      std::vector<char>         buffer;
+      std::vector<char>         out = std::vector<char>(chunk_size);
+      z_stream                  zs;
+      #ifdef SCA_WITH_ZSTD
+        ZSTD_CCtx*              cctx = nullptr;
+      #endif
+
+      bool compress(bool finish) {
+        std::size_t pending = pptr() - pbase();
+        if (format == Format::gzip) {
+          zs.next_in  = reinterpret_cast<Bytef*>(pbase());
+          zs.avail_in = static_cast<uInt>(pending);
+          int ret;
+          do {
+            zs.next_out  = reinterpret_cast<Bytef*>(out.data());
+            zs.avail_out = static_cast<uInt>(out.size());
+            ret = deflate(&zs, finish ? Z_FINISH : Z_NO_FLUSH);
+            file.write(out.data(), out.size() - zs.avail_out);
+          } while (zs.avail_out == 0 || (finish && ret != Z_STREAM_END));
+        }
+        #ifdef SCA_WITH_ZSTD
+          if (format == Format::zstd) {
+            ZSTD_inBuffer input = {pbase(), pending, 0};
+            std::size_t remaining;
+            do {
+              ZSTD_outBuffer output = {out.data(), out.size(), 0};
+              remaining = ZSTD_compressStream2(cctx, &output, &input, finish ? ZSTD_e_end : ZSTD_e_continue);
+              file.write(out.data(), output.pos);
+            } while (input.pos < input.size || (finish && remaining != 0));
+          }
+        #endif
+        setp(buffer.data(), buffer.data() + buffer.size());
+        return file.good();
+      }
+  };
+
+  class compressed_istream : public std::istream {
+    public:
+      compressed_istream(const std::string& path, std::ifstream&& file, Format format)
+      : std::istream(nullptr), buf(path, std::move(file), format) {
+        rdbuf(&buf);
+        exceptions(std::ios::badbit);
+      }
+    private:
+      decompress_streambuf buf;
+  };
+
+  class compressed_ostream : public std::ostream {
+    public:
+      compressed_ostream(const std::string& path, Format format)
+      : std::ostream(nullptr), buf(path, format) {
+        rdbuf(&buf);
+        if (!buf.is_open()) {setstate(std::ios::badbit);}
+      }
+      bool close() {return buf.finish();}
+    private:
+      compress_streambuf buf;
+  };
+
+  // Opens a plain, gzip or zstd file for reading; a missing file gives a
+  // stream in a failed state, like std::ifstream.
+  std::unique_ptr<std::istream> open_input(const std::string& path) {
+    std::unique_ptr<std::ifstream> file(new std::ifstream(path, std::ios::binary));
+    if (!file->is_open()) {return std::unique_ptr<std::istream>(std::move(file));}
+    Format format = detect(*file);
+    if (format == Format::none) {return std::unique_ptr<std::istream>(std::move(file));}
+    return std::unique_ptr<std::istream>(new compressed_istream(path, std::move(*file), format));
+  }
+
+  // flushes a closed file, or a directory's entries, to disk
+  bool sync_path(const std::string& path) {
+    #ifdef _WIN32
+      return true;
+    #else
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {return false;}
+      bool ok = ::fsync(fd) == 0;
+      ::close(fd);
+      return ok;
+    #endif
+  }
+
+  // Outputs of one unit of work (a chip) are committed together. While an
+  // output_unit is open on a thread, each stream that thread closes is left
+  // as its finished, fsynced .part file, and commit() renames them all only
+  // once every one was written without error. A unit destroyed without
+  // commit, e.g. by an exception, removes them, so a killed or failed chip
+  // leaves its previous reports, or none, never a truncated set.
+  class output_unit;
+  thread_local output_unit* current_unit = nullptr;
+
+  class output_unit {
+    public:
+      output_unit() : outer(current_unit) {current_unit = this;}
+      ~output_unit() {
+        current_unit = outer;
+        for (const auto& f : files) {std::remove(f.temp.c_str());}
+      }
+      output_unit(const output_unit&) = delete;
+      output_unit& operator=(const output_unit&) = delete;
+
+      void add(const std::string& temp, const std::string& path, bool ok) {files.push_back({temp, path, ok});}
+
+      void commit() {
+        for (const auto& f : files) {
+          if (!f.ok) {throw std::runtime_error("could not write '" + f.path + "'.");}
+        }
+        std::vector<std::string> directories;
+        for (const auto& f : files) {
+          if (std::rename(f.temp.c_str(), f.path.c_str()) != 0) {
+            throw std::runtime_error("could not replace '" + f.path + "'.");
+          }
+          std::size_t sep = f.path.find_last_of('/');
+          std::string directory = sep == std::string::npos ? "." : f.path.substr(0, sep + 1);
+          if (std::find(directories.begin(), directories.end(), directory) == directories.end()) {
+            directories.push_back(directory);
+          }
+        }
+        files.clear();
+        for (const auto& directory : directories) {sync_path(directory);}
+      }
+
+    private:
+      struct pending_file {
+        std::string temp;
+        std::string path;
+        bool        ok;
+      };
+      output_unit*              outer;
+      std::vector<pending_file> files;
+  };
+
+  // Writes to "<path>.part"; on close the file is finished and fsynced, then
+  // handed to the thread's output_unit or, outside one, renamed over `path`
+  // at once. A failed write never replaces `path`.
+  class atomic_ostream : public std::ostream {
+    public:
+      atomic_ostream(const std::string& path, Format format)
+      : std::ostream(nullptr), path(path), temp(path + ".part") {
+        if (format == Format::none) {plain.reset(new std::ofstream(temp, std::ios::binary));}
+        else {compressed.reset(new compressed_ostream(temp, format));}
+        std::ostream& file = plain ? static_cast<std::ostream&>(*plain) : *compressed;
+        rdbuf(file.rdbuf());
+        if (!file) {setstate(std::ios::badbit);}
+      }
+      ~atomic_ostream() {
+        flush();
+        bool ok = good();
+        rdbuf(nullptr);
+        if (plain) {
+          plain->close();
+          ok = ok && !plain->fail();
+        } else {
+          ok = compressed->close() && ok;
+        }
+        ok = ok && sync_path(temp);
+        if (current_unit) {
+          current_unit->add(temp, path, ok);
+        } else if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+          std::remove(temp.c_str());
+          std::cerr << "Error: could not write '" << path << "'." << std::endl;
+        }
+      }
+
+    private:
+      std::string                         path;
+      std::string                         temp;
+      std::unique_ptr<std::ofstream>      plain;
+      std::unique_ptr<compressed_ostream> compressed;
+  };
+
+  // Opens `path` for writing, adding .gz/.zst when compressing.
+  std::unique_ptr<std::ostream> open_output(const std::string& path, Format format) {
+    return std::unique_ptr<std::ostream>(new atomic_ostream(path + extension(format), format));
+  }
+
+  std::unique_ptr<std::ostream> open_output(const std::string& path) {
+    return open_output(path, output_format);
+  }
+}
+
+#endif // COMPRESS_SDS
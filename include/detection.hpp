@@ -0,0 +1,140 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: limit of detection and quantification from the standard series
+ *
+ */
+
+#ifndef DETECTION
+#define DETECTION
+
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "maths_sds.hpp"
+
+// Limits are in the same log10 abundance units as the standards. A well is
+// detected when it amplifies earlier than the detection Ct, which is the
+// cut-off or the earliest NTC/NEG well, whichever comes first. The LOD is
+// the abundance detected with 95% probability from a logistic fit of
+// detection against log abundance; when the series is fully separated (the
+// usual case with few dilutions) it falls back to the lowest dilution
+// detected in at least 95% of replicates. The LOQ is the lowest fully
+// detected dilution whose back-calculated copy numbers have a CV of at
+// most 35%, and is never below the LOD.
+namespace SmartchipDetection {
+  struct detection_limits {
+    double      detection_ct = std::numeric_limits<double>::quiet_NaN();
+    double      lod          = std::numeric_limits<double>::quiet_NaN();
+    double      loq          = std::numeric_limits<double>::quiet_NaN();
+    std::string method       = "none";
+  };
+
+  // maximum-likelihood (b0, b1) of P(detected) = 1 / (1 + exp(-(b0 + b1 x)))
+  // by Newton-Raphson; NaN when it does not converge
+  std::pair<double, double> logistic_fit(const std::vector<double>& X, const std::vector<char>& detected) {
+    double b0 = 0, b1 = 0;
+    for (int iteration = 0; iteration < 25; ++iteration) {
+      double g0 = 0, g1 = 0, h00 = 0, h01 = 0, h11 = 0;
+      for (std::size_t i = 0; i < X.size(); ++i) {
+        const double p = 1 / (1 + std::exp(-(b0 + b1 * X[i])));
+        const double w = p * (1 - p);
+        g0  += detected[i] - p;
+        g1  += (detected[i] - p) * X[i];
+        h00 += w;
+        h01 += w * X[i];
+        h11 += w * X[i] * X[i];
+      }
+      const double det = h00 * h11 - h01 * h01;
+      if (!(std::fabs(det) > 1e-12)) {break;}
+      const double d0 = ( h11 * g0 - h01 * g1) / det;
+      const double d1 = (-h01 * g0 + h00 * g1) / det;
+      b0 += d0;
+      b1 += d1;
+      if (std::fabs(d0) < 1e-8 && std::fabs(d1) < 1e-8) {return {b0, b1};}
+    }
+    return {std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN()};
+  }
+
+  detection_limits estimate(
+    const std::vector<double>&        log_abundances,
+    const std::vector<double>&        Ct_values,
+    const std::pair<double, double>&  curve,
+    const std::vector<double>&        blank_Cts,
+    double                            cutoff
+  ) {
+    detection_limits limits;
+    limits.detection_ct = cutoff;
+    for (double Ct : blank_Cts) {
+      if (std::isfinite(Ct) && Ct < limits.detection_ct) {limits.detection_ct = Ct;}
+    }
+
+    std::vector<double> X;
+    std::vector<char>   detected;
+    std::map<double, std::vector<double> > level_Cts;
+    std::map<double, int> level_wells;
+    for (std::size_t i = 0; i < log_abundances.size(); ++i) {
+      const double x = log_abundances[i];
+      const bool hit = std::isfinite(Ct_values[i]) && Ct_values[i] < limits.detection_ct;
+      X.push_back(x);
+      detected.push_back(hit);
+      ++level_wells[x];
+      if (hit) {level_Cts[x].push_back(Ct_values[i]);}
+    }
+    if (X.empty()) {return limits;}
+
+    // separated when every non-detect sits below every detect
+    double highest_miss = -std::numeric_limits<double>::infinity();
+    double lowest_hit   =  std::numeric_limits<double>::infinity();
+    for (std::size_t i = 0; i < X.size(); ++i) {
+      if (detected[i]) {lowest_hit = std::min(lowest_hit, X[i]);}
+      else {highest_miss = std::max(highest_miss, X[i]);}
+    }
+    if (highest_miss >= lowest_hit) {
+      std::pair<double, double> fit = logistic_fit(X, detected);
+      if (fit.second > 0) {
+        limits.lod    = (std::log(0.95 / 0.05) - fit.first) / fit.second;
+        limits.method = "logistic";
+      }
+    }
+    if (std::isnan(limits.lod)) {
+      for (const auto& level : level_wells) {
+        const auto hits = level_Cts.find(level.first);
+        const double rate = hits == level_Cts.end() ? 0 : double(hits->second.size()) / level.second;
+        if (rate >= 0.95) {
+          limits.lod    = level.first;
+          limits.method = "empirical";
+          break;
+        }
+      }
+    }
+
+    for (const auto& level : level_Cts) {
+      if (level.second.size() < 2 || int(level.second.size()) < level_wells[level.first]) {continue;}
+      std::vector<double> copies;
+      for (double Ct : level.second) {copies.push_back(std::pow(10, (Ct - curve.first) / curve.second));}
+      const double copy_mean = mean(copies);
+      if (copy_mean > 0 && sd(copies) / copy_mean <= 0.35) {
+        limits.loq = level.first;
+        break;
+      }
+    }
+    if (!std::isnan(limits.loq) && !std::isnan(limits.lod)) {limits.loq = std::max(limits.loq, limits.lod);}
+    return limits;
+  }
+
+  // PASS, BELOW_LOQ or BELOW_LOD for a copy number; NA without limits
+  std::string flag(double copy_N, const detection_limits& limits, double coefficient) {
+    if (std::isnan(limits.loq) || std::isnan(copy_N)) {return "NA";}
+    if (!std::isnan(limits.lod) && copy_N < coefficient * std::pow(10, limits.lod)) {return "BELOW_LOD";}
+    if (copy_N < coefficient * std::pow(10, limits.loq)) {return "BELOW_LOQ";}
+    return "PASS";
+  }
+}
+
+#endif // DETECTION
@@ -0,0 +1,126 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: input discovery over directory trees of chip exports
+ *
+ */
+
+#ifndef DISCOVER
+#define DISCOVER
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "defs_sds.hpp"
+#include "maths_sds.hpp"
+#include "thread_pool.hpp"
+
+// An input directory is searched for chip exports whose file names match
+// one of the patterns (by default CSVs, plain or compressed). With
+// `recursive`, subdirectories are searched too, e.g. a year/month/run share,
+// skipping hidden directories and our own sca_output directories. Each
+// subdirectory is read as its own pool task, so a deep tree is listed in
+// parallel, and chips found early can be queued on the same pool while the
+// rest of the tree is still being read.
+//
+// Entries whose type readdir does not report (DT_UNKNOWN, e.g. on some
+// network file systems) are typed with fstatat against the open directory.
+// Symbolic links are followed to files but never into directories.
+namespace SmartchipDiscover {
+  struct options {
+    vstring     patterns  = {"*.csv", "*.csv.gz", "*.csv.zst"};
+    bool        recursive = false;
+    std::string skip      = "sca_output";
+  };
+
+  // called with a file's path and its directory relative to the root
+  typedef std::function<void(const std::string&, const std::string&)> found_file;
+
+  bool matches(const options& opts, const char* name) {
+    for (const auto& pattern : opts.patterns) {
+      if (fnmatch(pattern.c_str(), name, 0) == 0) {return true;}
+    }
+    return false;
+  }
+
+  bool is_directory(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+  }
+
+  void walk_directory(ThreadPool& pool, const std::string& path, const std::string& relative,
+    const options& opts, const found_file& found) {
+    DIR* directory = opendir(path.c_str());
+    if (directory == nullptr) {
+      static std::mutex warn;
+      std::lock_guard<std::mutex> lock(warn);
+      std::cerr << "Warning: could not read directory '" << path << "'." << std::endl;
+      return;
+    }
+    const int fd = dirfd(directory);
+    dirent* entry;
+    while ((entry = readdir(directory)) != nullptr) {
+      const char* name = entry->d_name;
+      if (name[0] == '.') {continue;}
+      bool file = entry->d_type == DT_REG;
+      bool dir  = entry->d_type == DT_DIR;
+      if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+        struct stat info;
+        const bool link = entry->d_type == DT_LNK;
+        if (fstatat(fd, name, &info, link ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {continue;}
+        file = S_ISREG(info.st_mode);
+        dir  = !link && S_ISDIR(info.st_mode);
+      }
+      const std::string child = path + '/' + name;
+      if (file && matches(opts, name)) {
+        found(child, relative);
+      } else if (dir && opts.recursive && opts.skip != name) {
+        const std::string child_relative = relative.empty() ? name : relative + '/' + name;
+        pool.submit([&pool, child, child_relative, &opts, &found]() {
+          walk_directory(pool, child, child_relative, opts, found);
+        });
+      }
+    }
+    closedir(directory);
+  }
+
+  // Starts the walk on `pool`; `found` runs on the pool's workers and must be
+  // thread safe. A root that is not a directory is found as it is. The walk
+  // is done when pool.wait() returns, and `opts` and `found` must outlive it.
+  void walk(ThreadPool& pool, std::string root, const options& opts, const found_file& found) {
+    if (!is_directory(root)) {
+      found(root, "");
+      return;
+    }
+    while (root.size() > 1 && root.back() == '/') {root.pop_back();}
+    pool.submit([&pool, root, &opts, &found]() {walk_directory(pool, root, "", opts, found);});
+  }
+
+  // every input under `root`, sorted, for modes that need the full list
+  vstring list(const std::string& root, const options& opts, unsigned int threads) {
+    vstring files;
+    std::mutex files_mutex;
+    found_file collect = [&](const std::string& path, const std::string&) {
+      std::lock_guard<std::mutex> lock(files_mutex);
+      files.push_back(path);
+    };
+    {
+      ThreadPool pool(threads);
+      walk(pool, root, opts, collect);
+      pool.wait();
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+  }
+}
+
+#endif // DISCOVER
@@ -0,0 +1,131 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: instrument Flags column decoded to a per-well bitmask
+ *
+ */
+
+#ifndef FLAGS
+#define FLAGS
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+
+#include "maths_sds.hpp"
+#include "maps_sds.hpp"
+
+// The SmartChip export lists a well's flags in its last column, several of
+// them as one quoted field ("LowEfficiency, CtIsLarge"), which the plain
+// comma split has already broken into consecutive fields. Each well's flags
+// are decoded once from those fields into a bitmask, one bit per known flag
+// name, so excluding flagged wells is a single AND per well. Known names are
+// found with a perfect hash: FNV-1a of the token, scaled by `seed` into 16
+// slots, with no two names sharing a slot. Unrecognised tokens set `other`.
+namespace SmartchipFlags {
+  constexpr const char* names[] = {
+    "NoAmplification", "LowEfficiency", "HighEfficiency", "CtIsLarge",
+    "MultipleMeltPeaks", "CurveFitFailed", "BadR2"
+  };
+  constexpr int           known = sizeof(names) / sizeof(names[0]);
+  constexpr std::uint32_t other = 1u << 31;
+  constexpr std::uint32_t seed  = 17;
+
+  constexpr std::uint32_t fnv1a(const char* s, std::size_t n) {
+    std::uint32_t h = 2166136261u;
+    for (std::size_t i = 0; i < n; ++i) {h = (h ^ static_cast<unsigned char>(s[i])) * 16777619u;}
+    return h;
+  }
+
+  constexpr std::size_t length(const char* s) {
+    std::size_t n = 0;
+    while (s[n]) {++n;}
+    return n;
+  }
+
+  constexpr int slot(const char* s, std::size_t n) {
+    return static_cast<int>((fnv1a(s, n) * seed) >> 28);
+  }
+
+  constexpr bool collision_free() {
+    for (int i = 0; i < known; ++i) {
+      for (int j = i + 1; j < known; ++j) {
+        if (slot(names[i], length(names[i])) == slot(names[j], length(names[j]))) {return false;}
+      }
+    }
+    return true;
+  }
+  static_assert(collision_free(), "flag names must hash to distinct slots; choose a new seed");
+
+  // flag index per slot, -1 for an empty slot
+  const std::vector<int>& slots() {
+    static const std::vector<int> table = [] {
+      std::vector<int> t(16, -1);
+      for (int i = 0; i < known; ++i) {t[slot(names[i], length(names[i]))] = i;}
+      return t;
+    }();
+    return table;
+  }
+
+  // bit for one flag name, trimmed of spaces and quotes; 0 when empty
+  std::uint32_t bit(const std::string& field) {
+    std::size_t begin = field.find_first_not_of(" \"");
+    if (begin == std::string::npos) {return 0;}
+    std::size_t end = field.find_last_not_of(" \"\r") + 1;
+    const char* token = field.data() + begin;
+    const std::size_t n = end - begin;
+    const int index = slots()[slot(token, n)];
+    if (index >= 0 && length(names[index]) == n && field.compare(begin, n, names[index]) == 0) {
+      return 1u << index;
+    }
+    return other;
+  }
+
+  // a well's flags: the field at `column`, or the run of fields from it
+  // to the one closing its quote
+  std::uint32_t decode(const csv_row& row, int column) {
+    const std::string& first = csv_field(row, column);
+    std::uint32_t mask = bit(first);
+    if (first.empty() || first[0] != '"' || (first.size() > 1 && first.back() == '"')) {return mask;}
+    for (std::size_t i = column + 1; i < row.size(); ++i) {
+      mask |= bit(row[i]);
+      if (!row[i].empty() && row[i].back() == '"') {break;}
+    }
+    return mask;
+  }
+
+  std::vector<std::uint32_t> decode_column(const csv_table& table, int column) {
+    std::vector<std::uint32_t> masks(table.rows.size());
+    for (std::size_t i = 0; i < table.rows.size(); ++i) {masks[i] = decode(table.rows[i], column);}
+    return masks;
+  }
+
+  // names of the flags in `mask`, separated by ';'
+  std::string describe(std::uint32_t mask) {
+    std::string text;
+    for (int i = 0; i < known; ++i) {
+      if (mask & (1u << i)) {text += (text.empty() ? "" : ";") + std::string(names[i]);}
+    }
+    if (mask & other) {text += text.empty() ? "other" : ";other";}
+    return text;
+  }
+
+  // "LowEfficiency,CtIsLarge" to a mask; unknown names are an error
+  std::uint32_t parse_mask(const std::string& list) {
+    std::uint32_t mask = 0;
+    for (const auto& name : string_split(list, ',')) {
+      std::uint32_t flag = bit(name);
+      if (flag == other) {
+        std::string choices;
+        for (int i = 0; i < known; ++i) {choices += (i ? ", " : "") + std::string(names[i]);}
+        throw std::invalid_argument("unknown flag '" + name + "' (use " + choices + ").");
+      }
+      mask |= flag;
+    }
+    return mask;
+  }
+}
+
+#endif // FLAGS
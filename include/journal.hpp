@@ -0,0 +1,88 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: batch journal of committed chips, for resuming a directory run
+ *
+ */
+
+#ifndef JOURNAL
+#define JOURNAL
+
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+#include <stdexcept>
+#ifndef _WIN32
+  #include <unistd.h>
+#endif
+
+#include "defs_sds.hpp"
+#include "maths_sds.hpp"
+
+// A directory batch journals each chip once its reports are committed, one
+// "input<TAB>modified time" line, appended and fsynced, so the journal never
+// lists a chip whose reports could still be missing. A batch that finishes
+// without errors removes its journal; after a killed or partly failed batch
+// it stays, and a --resume run skips the chips it lists whose input has not
+// changed since.
+namespace SmartchipJournal {
+  // fixed formatting, so a time read back compares equal to a fresh one
+  std::string time_text(double modified) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.9f", modified);
+    return text;
+  }
+
+  class journal {
+    public:
+      ~journal() {if (file) {std::fclose(file);}}
+
+      // `resume` keeps and reads an existing journal; otherwise it starts over
+      void open(const std::string& journal_path, bool resume) {
+        path = journal_path;
+        if (resume) {
+          std::unique_ptr<std::istream> journal_stream = SdsCompress::open_input(path);
+          std::string line;
+          while (*journal_stream && std::getline(*journal_stream, line)) {
+            std::size_t tab = line.find('\t');
+            if (tab != std::string::npos) {committed[line.substr(0, tab)] = line.substr(tab + 1);}
+          }
+        }
+        file = std::fopen(path.c_str(), resume ? "a" : "w");
+        if (!file) {throw std::runtime_error("could not open journal '" + path + "'.");}
+      }
+
+      bool done(const std::string& input, double modified) const {
+        auto found = committed.find(input);
+        return found != committed.end() && found->second == time_text(modified);
+      }
+
+      void record(const std::string& input, double modified) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::fprintf(file, "%s\t%s\n", input.c_str(), time_text(modified).c_str());
+        std::fflush(file);
+        #ifndef _WIN32
+          fsync(fileno(file));
+        #endif
+      }
+
+      // closes the journal, removing it when the whole batch succeeded
+      void finish(bool complete) {
+        if (!file) {return;}
+        std::fclose(file);
+        file = nullptr;
+        if (complete) {std::remove(path.c_str());}
+      }
+
+    private:
+      std::string   path;
+      std::FILE*    file = nullptr;
+      std::mutex    mutex;
+      um_str_str    committed;
+  };
+}
+
+#endif // JOURNAL
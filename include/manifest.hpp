@@ -0,0 +1,218 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: batch manifests of chips with per-chip parameter overrides
+ *
+ */
+
+#ifndef MANIFEST
+#define MANIFEST
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+#include "scaclass.cpp"
+
+// A manifest is a tab-separated file with a header line. The "input" column
+// is required; every other column is named after a long command line option
+// and overrides it for that row, with an empty cell keeping the command line
+// value. Lines starting with '#' are ignored.
+//
+//   input             negcontrol  standard  magnitudes         effmin
+//   run1/chipA.csv    NEG         STD       panels/soil.map    1.75
+//   run1/chipB.csv    none        CAL
+//
+// Support files (magnitudes, replacements, qc-rules, standards) are parsed once per
+// distinct path before any job runs and shared by every job that names them.
+namespace SmartchipManifest {
+  const vstring& columns() {
+    static const vstring names = {
+      "input", "output", "Ct", "assay", "sample", "efficiency", "negcontrol", "standard",
+      "nontemplate", "effmin", "effmax", "rsquare", "replacements", "magnitudes",
+      "qc-rules", "robust", "lod", "detection-ct", "spatial",
+      "melt", "melt-tolerance", "exclude-flags", "outliers", "outlier-alpha",
+      "audit", "standards"
+    };
+    return names;
+  }
+
+  struct job {
+    int                                 line;
+    std::string                         input;
+    std::map<std::string, std::string>  settings;
+  };
+
+  std::vector<job> read_manifest(const std::string& path) {
+    std::unique_ptr<std::istream> manifest_stream = SdsCompress::open_input(path);
+    std::istream& manifest = *manifest_stream;
+    if (!manifest) {throw std::invalid_argument("manifest '" + path + "' not found.");}
+    std::string line;
+    vstring header;
+    std::vector<job> jobs;
+    int line_number = 0;
+    while (std::getline(manifest, line)) {
+      ++line_number;
+      if (!line.empty() && line.back() == '\r') {line.pop_back();}
+      if (line.empty() || line[0] == '#') {continue;}
+      vstring fields = string_split(line, '\t');
+      if (header.empty()) {
+        header = fields;
+        for (const auto& name : header) {
+          if (!SmartchipInfra::contained_in_vector(columns(), name)) {
+            throw std::invalid_argument("manifest '" + path + "' has unknown column '" + name + "'.");
+          }
+        }
+        if (!SmartchipInfra::contained_in_vector(header, "input")) {
+          throw std::invalid_argument("manifest '" + path + "' missing required field 'input'.");
+        }
+        continue;
+      }
+      job parsed;
+      parsed.line = line_number;
+      for (std::size_t i = 0; i < header.size() && i < fields.size(); ++i) {
+        if (fields[i].empty()) {continue;}
+        if (header[i] == "input") {parsed.input = fields[i];}
+        else {parsed.settings[header[i]] = fields[i];}
+      }
+      if (parsed.input.empty()) {
+        throw std::invalid_argument("manifest '" + path + "' line " + std::to_string(line_number) + " has no input.");
+      }
+      jobs.push_back(parsed);
+    }
+    return jobs;
+  }
+
+  // Parsed support files by path. A file that fails to load is remembered
+  // with its error, which is raised by every job that uses it.
+  class shared_resources {
+    public:
+      void load(const std::vector<job>& jobs) {
+        for (const auto& j : jobs) {
+          for (const auto& setting : j.settings) {
+            const std::string& path = setting.second;
+            try {
+              if (setting.first == "magnitudes" && !magnitudes.count(path)) {
+                SmartchipInfra::file_check(path);
+                magnitudes[path] = file_map(path);
+              } else if (setting.first == "replacements" && !replacements.count(path)) {
+                SmartchipInfra::file_check(path);
+                replacements[path] = std::make_shared<const csv_table>(read_csv(path));
+              } else if (setting.first == "qc-rules" && !rules.count(path)) {
+                rules[path].load(path);
+              } else if (setting.first == "standards" && !standards.count(path)) {
+                standards[path].load(path);
+              }
+            }
+            catch (const std::exception& e) {errors[path] = e.what();}
+          }
+        }
+      }
+
+      void check(const std::string& path) const {
+        auto error = errors.find(path);
+        if (error != errors.end()) {throw std::invalid_argument(error->second);}
+      }
+
+      std::map<std::string, um_str_flo>                         magnitudes;
+      std::map<std::string, std::shared_ptr<const csv_table> >  replacements;
+      std::map<std::string, SmartchipRules::rule_set>           rules;
+      std::map<std::string, SmartchipStandards::definition>     standards;
+
+    private:
+      std::map<std::string, std::string>                        errors;
+  };
+
+  float to_float(const job& j, const std::string& name, const std::string& value) {
+    try {
+      return std::stof(value);
+    }
+    catch (const std::exception&) {
+      throw std::invalid_argument("line " + std::to_string(j.line) + ": '" + name + "' is not a number.");
+    }
+  }
+
+  bool to_bool(const std::string& value) {
+    return value == "1" || value == "true" || value == "yes";
+  }
+
+  // Applies a job's overrides on top of parameters already configured from
+  // the command line.
+  void apply(SmartchipParameters& params, const job& j, const shared_resources& resources) {
+    for (const auto& setting : j.settings) {
+      const std::string& name  = setting.first;
+      const std::string& value = setting.second;
+      if      (name == "output")        {params.set_output_dir(value);}
+      else if (name == "Ct")            {params.set_qPCR_ct_colname(value);}
+      else if (name == "assay")         {params.set_assay_colname(value);}
+      else if (name == "sample")        {params.set_sample_colname(value);}
+      else if (name == "efficiency")    {params.set_efficiency_colname(value);}
+      else if (name == "negcontrol")    {params.set_negative_control(value);}
+      else if (name == "standard")      {params.set_standard_id(value);}
+      else if (name == "nontemplate")   {params.set_non_template_control(value);}
+      else if (name == "effmin")        {params.set_efficiency_min(to_float(j, name, value));}
+      else if (name == "effmax")        {params.set_efficiency_max(to_float(j, name, value));}
+      else if (name == "rsquare")       {params.set_r_sqared_threshold(to_float(j, name, value));}
+      else if (name == "detection-ct")  {params.set_detection_ct(to_float(j, name, value));}
+      else if (name == "robust")        {params.set_robust_method(parse_robust_weight(value));}
+      else if (name == "lod")           {params.set_estimate_limits(to_bool(value));}
+      else if (name == "spatial")       {params.set_spatial(to_bool(value));}
+      else if (name == "melt")          {params.set_melt(to_bool(value));}
+      else if (name == "melt-tolerance") {params.set_melt_tolerance(to_float(j, name, value));}
+      else if (name == "exclude-flags") {params.set_exclude_flags(SmartchipFlags::parse_mask(value));}
+      else if (name == "outliers")      {params.set_outlier_test(SmartchipOutliers::parse_method(value));}
+      else if (name == "outlier-alpha") {params.set_outlier_alpha(to_float(j, name, value));}
+      else if (name == "audit")         {params.set_audit(to_bool(value));}
+      else if (name == "magnitudes") {
+        resources.check(value);
+        params.gene_magnitudes = resources.magnitudes.at(value);
+        params.gene_magnitudes_path = value;
+      } else if (name == "replacements") {
+        resources.check(value);
+        params.replacement_stds_path = value;
+        params.replacement_table = resources.replacements.at(value);
+      } else if (name == "qc-rules") {
+        resources.check(value);
+        params.set_qc_rules(resources.rules.at(value));
+      } else if (name == "standards") {
+        resources.check(value);
+        params.set_standards(resources.standards.at(value));
+      }
+    }
+    SmartchipOutliers::validate(params.outlier_test, params.outlier_alpha);
+  }
+
+  struct job_status {
+    int         line    = 0;
+    std::string input;
+    bool        ok      = false;
+    double      seconds = 0;
+    std::string message;
+  };
+
+  void write_status(const std::string& path, const std::vector<job_status>& statuses) {
+    std::unique_ptr<std::ostream> status_stream = SdsCompress::open_output(path);
+    std::ostream& status_file = *status_stream;
+    status_file << "line\tinput\tstatus\tseconds\tmessage\n";
+    for (const auto& status : statuses) {
+      status_file << status.line << "\t" << status.input << "\t" << (status.ok ? "OK" : "FAILED")
+        << "\t" << status.seconds << "\t" << status.message << "\n";
+    }
+  }
+
+  // <manifest without extension>_status.tsv
+  std::string status_path(const std::string& manifest) {
+    std::string base = SdsCompress::strip_extension(manifest);
+    std::size_t dot = base.find_last_of('.');
+    std::size_t sep = base.find_last_of("/\\");
+    if (dot != std::string::npos && (sep == std::string::npos || dot > sep)) {base = base.substr(0, dot);}
+    return base + "_status.tsv";
+  }
+}
+
+#endif // MANIFEST
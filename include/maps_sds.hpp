@@ -19,7 +19,13 @@
 #include <regex>
 #include <numeric>
 #include <cmath>
+#include <memory>
+#include <cstdint>
+#include <limits>
 
+#include "profile.hpp"
+#include "compress_sds.hpp"
+#include "arena.hpp"
 
 typedef std::unordered_map<std::string, std::vector<std::string> >  um_str_vstr;
 typedef std::multimap<std::string, std::string>                     mm_str_str;
@@ -39,12 +45,14 @@ auto extract_values(std::unordered_map<std::string, double> const& input_map) {
 }
 
 auto map_headers(std::string input_csv_file) {
-  std::ifstream csv_file(input_csv_file);
+  std::unique_ptr<std::istream> csv_stream = SdsCompress::open_input(input_csv_file);
+  std::istream& csv_file = *csv_stream;
   std::string line;
   std::string csv_line;
   std::vector<std::string> row_data;
   std::unordered_map<std::string, int> headers;
   while(std::getline(csv_file, line)) {
+    SmartchipProfile::record_read(line.size() + 1);
     std::stringstream line_(line);
     std::getline(line_, csv_line, '\t');
     row_data = string_split(csv_line,',');
@@ -57,13 +65,15 @@ auto map_headers(std::string input_csv_file) {
 }
 
 auto map_variable_vec(std::string input_csv_file, std::vector<std::string> variables, std::vector<std::string> values, bool headers=true) {
-  std::ifstream csv_file(input_csv_file);
+  std::unique_ptr<std::istream> csv_stream = SdsCompress::open_input(input_csv_file);
+  std::istream& csv_file = *csv_stream;
   std::string line;
   std::vector<std::string> row_data;
   std::unordered_map<std::string, int> colnames;
   colnames = map_headers(input_csv_file);
   um_str_vstr variable_map;
   while(std::getline(csv_file, line)) {
+    SmartchipProfile::record_read(line.size() + 1);
     if (headers) {headers=false; continue;}
     row_data = string_split(line,',');
     std::string key, value;
@@ -83,7 +93,8 @@ auto map_variable_vec(std::string input_csv_file, std::vector<std::string> varia
 }
 
 auto map_variable_vec_numeric(std::string input_csv_file, std::vector<std::string> variables, std::vector<std::string> values, bool headers=true) {
-  std::ifstream csv_file(input_csv_file);
+  std::unique_ptr<std::istream> csv_stream = SdsCompress::open_input(input_csv_file);
+  std::istream& csv_file = *csv_stream;
   std::string line;
   std::vector<std::string> row_data;
   std::unordered_map<std::string, int> colnames;
@@ -91,6 +102,7 @@ auto map_variable_vec_numeric(std::string input_csv_file, std::vector<std::strin
   um_str_vdbl variable_map;
   double value;
   while(std::getline(csv_file, line)) {
+    SmartchipProfile::record_read(line.size() + 1);
     if (headers) {headers=false; continue;}
     row_data = string_split(line,',');
     std::string key, val;
@@ -110,6 +122,117 @@ auto map_variable_vec_numeric(std::string input_csv_file, std::vector<std::strin
   return variable_map;
 }
 
+// In-memory copy of a CSV, so several maps can be built from one read.
+// The table overloads below take column indices (see csv_table::colnames),
+// resolved once by the caller rather than looked up for every row.
+//
+// A table created inside a chip_scope keeps its rows in the chip's arena
+// (see arena.hpp): one bump allocation per row, as the fields themselves
+// are short enough to live inside their strings. Elsewhere, e.g. support
+// files shared across chips, the rows are on the heap.
+typedef std::pmr::vector<std::string> csv_row;
+
+struct csv_table {
+  std::unordered_map<std::string, int>  colnames;
+  std::pmr::vector<csv_row>             rows = std::pmr::vector<csv_row>(SmartchipArena::resource());
+};
+
+// string_split into `row`, appending to its own storage
+void split_fields(const std::string& line, char delim, csv_row& row) {
+  row.emplace_back();
+  for (char c : line) {
+    if (c == '\n') {continue;}
+    if (c == delim) {row.emplace_back();} else {row.back() += c;}
+  }
+  if (row.back().empty()) {row.pop_back();}
+}
+
+auto read_csv(std::string input_csv_file) {
+  csv_table table;
+  std::unique_ptr<std::istream> csv_stream = SdsCompress::open_input(input_csv_file);
+  std::istream& csv_file = *csv_stream;
+  std::string line;
+  bool headers = true;
+  while(std::getline(csv_file, line)) {
+    SmartchipProfile::record_read(line.size() + 1);
+    if (headers) {
+      headers=false;
+      std::vector<std::string> row_data = string_split(line,',');
+      for (std::size_t i = 0; i < row_data.size(); ++i) {table.colnames[row_data[i]] = i;}
+      continue;
+    }
+    csv_row& row = table.rows.emplace_back();
+    row.reserve(table.colnames.size());
+    split_fields(line, ',', row);
+  }
+  return table;
+}
+
+const std::string& csv_field(const csv_row& row, int column) {
+  static const std::string empty;
+  if (column < 0 || column >= static_cast<int>(row.size())) {return empty;}
+  return row[column];
+}
+
+auto map_variable_vec(const csv_table& table, std::vector<int> variables, std::vector<int> values) {
+  um_str_vstr variable_map;
+  for (const auto& row_data : table.rows) {
+    std::string key, value;
+    for (std::size_t i = 0; i < variables.size(); ++i) {key.append(csv_field(row_data, variables[i]));}
+    for (std::size_t i = 0; i < values.size(); ++i) {value.append(csv_field(row_data, values[i]));}
+    if (value.empty()) {value = "NAN";}
+    std::vector<std::string>& vec = variable_map[key];
+    if (std::find(vec.begin(), vec.end(), value) == vec.end()) {vec.push_back(value);}
+  }
+  return variable_map;
+}
+
+// rows whose `flags` share a bit with `exclude` read as missing values
+auto map_variable_vec_numeric(
+  const csv_table&                  table,
+  std::vector<int>                  variables,
+  std::vector<int>                  values,
+  const std::vector<std::uint32_t>& flags   = std::vector<std::uint32_t>(),
+  std::uint32_t                     exclude = 0
+) {
+  um_str_vdbl variable_map;
+  double value;
+  const bool masked = exclude && !flags.empty();
+  for (std::size_t r = 0; r < table.rows.size(); ++r) {
+    const auto& row_data = table.rows[r];
+    std::string key, val;
+    for (std::size_t i = 0; i < variables.size(); ++i) {key.append(csv_field(row_data, variables[i]));}
+    for (std::size_t i = 0; i < values.size(); ++i) {
+      val = csv_field(row_data, values[i]);
+      if (val.empty()) {val = "NAN";}
+      value = std::stof(val);
+    }
+    if (masked) {value = (flags[r] & exclude) ? std::numeric_limits<double>::quiet_NaN() : value;}
+    // every replicate is kept, in table order
+    variable_map[key].push_back(value);
+  }
+  return variable_map;
+}
+
+auto map_variable(const csv_table& table, std::vector<int> variables, int value) {
+  std::unordered_map<std::string, std::string> variable_map;
+  for (const auto& row_data : table.rows) {
+    std::string key;
+    for (std::size_t i = 0; i < variables.size(); ++i) {key.append(csv_field(row_data, variables[i]));}
+    variable_map[key] = csv_field(row_data, value);
+  }
+  return variable_map;
+}
+
+// read-only lookup: a missing key gives a default value rather than
+// inserting one, so finished stage results can be shared as const.
+template <typename Map>
+const typename Map::mapped_type& um_at(const Map& map, const std::string& key) {
+  static const typename Map::mapped_type none{};
+  auto it = map.find(key);
+  return it == map.end() ? none : it->second;
+}
+
 auto um_percent_below_threshold(um_str_vdbl val_map, double threshold) {
   std::unordered_map<std::string, double> perc;
   for (auto it : val_map) {
@@ -125,24 +248,31 @@ auto um_percent_below_threshold(um_str_vdbl val_map, double threshold) {
   return perc;
 }
 
-auto um_mean(um_str_vdbl val_map) {
+// mean() of each group, with the finite values gathered in one arena
+// scratch vector reused across groups instead of a copy per call
+auto um_mean(const um_str_vdbl& val_map) {
   std::unordered_map<std::string, double> means;
-  for (auto it : val_map) {
-    std::vector<double> values(it.second);
-    means[it.first] = mean(values);
+  SmartchipArena::vector<double> kept(SmartchipArena::resource());
+  for (const auto& it : val_map) {
+    kept.clear();
+    for (double v : it.second) {
+      if (v == v) {kept.push_back(v);}
+    }
+    means[it.first] = kept.empty() ? std::numeric_limits<double>::quiet_NaN()
+      : std::accumulate(kept.begin(), kept.end(), 0.0) / static_cast<int>(kept.size());
   }
   return means;
 }
 
-auto um_sd(um_str_vdbl val_map) {
+auto um_sd(const um_str_vdbl& val_map) {
   std::unordered_map<std::string, double> means;
   std::unordered_map<std::string, double> sd;
   means = um_mean(val_map);
-  for (auto it : val_map) {
-    std::vector<double> values(it.second);
+  for (const auto& it : val_map) {
+    const double group_mean = means[it.first];
     double variance = 0;
-    for (auto v : values) {
-      variance += std::pow((v - means[it.first]), 2);
+    for (auto v : it.second) {
+      variance += std::pow((v - group_mean), 2);
     }
     sd[it.first] = std::sqrt(variance);
   }
@@ -150,13 +280,15 @@ auto um_sd(um_str_vdbl val_map) {
 }
 
 auto map_variable(std::string input_csv_file, std::vector<std::string> variables, std::string value, bool headers=true) {
-  std::ifstream csv_file(input_csv_file);
+  std::unique_ptr<std::istream> csv_stream = SdsCompress::open_input(input_csv_file);
+  std::istream& csv_file = *csv_stream;
   std::string line;
   std::vector<std::string> row_data;
   std::unordered_map<std::string, std::string> variable_map;
   std::unordered_map<std::string, int> colnames;
   colnames = map_headers(input_csv_file);
   while(std::getline(csv_file, line)) {
+    SmartchipProfile::record_read(line.size() + 1);
     if (headers) {headers=false; continue;}
     row_data = string_split(line,',');
     std::string key;
@@ -179,13 +311,15 @@ auto map_value_as_numeric(std::string input_csv_file, std::vector<std::string> v
 }
 
 auto map_csv(std::string input_csv_file, std::string variable, bool headers=true) {
-  std::ifstream csv_file(input_csv_file);
+  std::unique_ptr<std::istream> csv_stream = SdsCompress::open_input(input_csv_file);
+  std::istream& csv_file = *csv_stream;
   std::string line;
   std::vector<std::string> row_data;
   std::unordered_map<std::string, std::string> csv_map;
   std::unordered_map<std::string, int> colnames;
   colnames = map_headers(input_csv_file);
   while(std::getline(csv_file, line)) {
+    SmartchipProfile::record_read(line.size() + 1);
     if (headers) {headers=false; continue;}
     row_data = string_split(line,',');
     std::string key, value;
@@ -227,10 +361,12 @@ void print_um(um_str_vstr const &m) {
 
 auto file_map(std::string file_name) {
   std::unordered_map<std::string, float> out_map;
-  std::ifstream file(file_name);
+  std::unique_ptr<std::istream> file_stream = SdsCompress::open_input(file_name);
+  std::istream& file = *file_stream;
   std::string line;
   while(std::getline(file, line))
   {
+    SmartchipProfile::record_read(line.size() + 1);
     std::vector<std::string> words;
     words = string_split(line,':');
     out_map[words[0]] = std::stof(words[1]);
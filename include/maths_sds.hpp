@@ -15,6 +15,8 @@
 #include <algorithm>
 #include <math.h>
 #include <tuple>
+#include <cctype>
+#include <stdexcept>
 
 
 auto which_nan(std::vector<double> values) {
@@ -31,6 +33,7 @@ auto rm_nan(std::vector<double> values, std::vector<int> nan_indices = {}) {
   if (nan_indices.size() == 0) {nan_indices = which_nan(values);}
   if (nan_indices.size() > 0) {
     std::sort(nan_indices.begin(), nan_indices.end(), std::greater<int>()); 
+    nan_indices.erase(std::unique(nan_indices.begin(), nan_indices.end()), nan_indices.end());
     for (auto nan_i : nan_indices) {
       values.erase(values.begin() + nan_i);
     }
@@ -131,6 +134,106 @@ auto coef_determination(std::vector<double> X, std::vector<double> Y) {
   return SSR/SSE;
 }
 
+// Robust standard curves: iteratively reweighted least squares with Huber
+// or Tukey bisquare weights. Every iteration is one pass of weighted sums
+// over the pairs, and all scratch space lives in a caller-owned workspace,
+// so fitting many assays reuses the same buffers.
+enum class robust_weight {none, huber, tukey};
+
+robust_weight parse_robust_weight(const std::string& name) {
+  if (name.empty() || name == "none") {return robust_weight::none;}
+  if (name == "huber")                {return robust_weight::huber;}
+  if (name == "tukey")                {return robust_weight::tukey;}
+  throw std::invalid_argument("unknown robust fit '" + name + "' (use none, huber or tukey).");
+}
+
+struct robust_workspace {
+  std::vector<double> weights;
+  std::vector<double> residuals;
+  std::vector<double> scratch;
+};
+
+struct robust_fit {
+  double a          = 0;
+  double b          = 0;
+  double rsqr       = 0;
+  int    iterations = 0;
+};
+
+// weighted line fit in a single pass; pairs with a NaN or zero weight drop out
+robust_fit weighted_lm(const std::vector<double>& X, const std::vector<double>& Y, const std::vector<double>& W) {
+  double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+  for (std::size_t i = 0; i < X.size(); ++i) {
+    const double w = W[i];
+    if (!(w > 0)) {continue;}
+    sw  += w;
+    sx  += w * X[i];
+    sy  += w * Y[i];
+    sxx += w * X[i] * X[i];
+    sxy += w * X[i] * Y[i];
+    syy += w * Y[i] * Y[i];
+  }
+  robust_fit fit;
+  const double Sxx = sxx - sx * sx / sw;
+  const double Sxy = sxy - sx * sy / sw;
+  const double Syy = syy - sy * sy / sw;
+  fit.b    = Sxy / Sxx;
+  fit.a    = (sy - fit.b * sx) / sw;
+  fit.rsqr = fit.b * fit.b * Sxx / Syy;
+  return fit;
+}
+
+robust_fit robust_lm(
+  const std::vector<double>&  X,
+  const std::vector<double>&  Y,
+  robust_weight               kind,
+  robust_workspace&           ws,
+  int                         max_iterations = 50
+) {
+  const std::size_t n = X.size();
+  ws.weights.assign(n, 1.0);
+  ws.residuals.resize(n);
+  std::size_t finite = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    if (std::isnan(X[i]) || std::isnan(Y[i])) {ws.weights[i] = 0;} else {++finite;}
+  }
+  robust_fit fit = weighted_lm(X, Y, ws.weights);
+  if (kind == robust_weight::none || finite < 3) {return fit;}
+
+  // tuning constants give 95% efficiency for normal residuals
+  const double c = kind == robust_weight::huber ? 1.345 : 4.685;
+  for (int iteration = 1; iteration <= max_iterations; ++iteration) {
+    ws.scratch.clear();
+    for (std::size_t i = 0; i < n; ++i) {
+      if (std::isnan(X[i]) || std::isnan(Y[i])) {continue;}
+      ws.residuals[i] = Y[i] - (fit.a + fit.b * X[i]);
+      ws.scratch.push_back(std::fabs(ws.residuals[i]));
+    }
+    // MAD of the residuals, scaled to estimate the standard deviation
+    auto middle = ws.scratch.begin() + ws.scratch.size() / 2;
+    std::nth_element(ws.scratch.begin(), middle, ws.scratch.end());
+    const double scale = *middle / 0.6745;
+    if (!(scale > 0)) {break;}
+    for (std::size_t i = 0; i < n; ++i) {
+      if (std::isnan(X[i]) || std::isnan(Y[i])) {continue;}
+      const double u = std::fabs(ws.residuals[i]) / (c * scale);
+      if (kind == robust_weight::huber) {
+        ws.weights[i] = u <= 1 ? 1 : 1 / u;
+      } else {
+        ws.weights[i] = u < 1 ? (1 - u * u) * (1 - u * u) : 0;
+      }
+    }
+    robust_fit next = weighted_lm(X, Y, ws.weights);
+    if (std::isnan(next.b)) {break;}
+    next.iterations = iteration;
+    const bool converged = std::fabs(next.a - fit.a) <= 1e-10 * (1 + std::fabs(fit.a))
+      && std::fabs(next.b - fit.b) <= 1e-10 * (1 + std::fabs(fit.b));
+    fit = next;
+    if (converged) {break;}
+  }
+  return fit;
+}
+
 void sort_numeric_strings(std::vector<std::string> &v) {
   std::vector<int> temp;
   for (auto it : v) {temp.push_back(std::stoi(it));}
@@ -167,27 +270,52 @@ auto search_vsrting(std::vector<std::string> v, std::string pattern) {
   return match;
 }
 
-bool is_not_digit(char c) {
-  return !std::isdigit(c);
+// Sort key for natural, case-insensitive order: letters are folded to lower
+// case and each run of digits becomes '0', its significant digit count and
+// the digits, so "STD2" < "STD10" under a plain byte comparison. Names equal
+// up to case or leading zeros share a key.
+std::string collation_key(const std::string& name) {
+  std::string key;
+  key.reserve(name.size() + 4);
+  for (std::size_t i = 0; i < name.size();) {
+    const unsigned char c = name[i];
+    if (!std::isdigit(c)) {
+      key += static_cast<char>(std::tolower(c));
+      ++i;
+      continue;
+    }
+    std::size_t end = i;
+    while (end < name.size() && std::isdigit(static_cast<unsigned char>(name[end]))) {++end;}
+    std::size_t first = i;
+    while (first < end && name[first] == '0') {++first;}
+    key += '0';
+    key += static_cast<char>(std::min<std::size_t>(end - first, 255));
+    key.append(name, first, end - first);
+    i = end;
+  }
+  return key;
 }
 
-bool numeric_string_compare(const std::string& s1, const std::string& s2) {
-  // handle empty strings...
-  std::string::const_iterator it1 = s1.begin(), it2 = s2.begin();
-  if (std::isdigit(s1[0]) && std::isdigit(s2[0])) {
-    int n1, n2;
-    std::stringstream ss(s1);
-    ss >> n1;
-    ss.clear();
-    ss.str(s2);
-    ss >> n2;
-    if (n1 != n2) return n1 < n2;
-    it1 = std::find_if (s1.begin(), s1.end(), is_not_digit);
-    it2 = std::find_if (s2.begin(), s2.end(), is_not_digit);
-  }
-  return std::lexicographical_compare(it1, s1.end(), it2, s2.end());
+bool natural_less(const std::string& lhs, const std::string& rhs) {
+  int order = collation_key(lhs).compare(collation_key(rhs));
+  return order != 0 ? order < 0 : lhs < rhs;
 }
 
+// sorts `names` in natural order, building each key once; ties on the key
+// fall back to the names themselves, so the order never depends on input order
+void natural_sort(std::vector<std::string>& names) {
+  std::vector<std::pair<std::string, std::size_t> > keys(names.size());
+  for (std::size_t i = 0; i < names.size(); ++i) {keys[i] = {collation_key(names[i]), i};}
+  std::sort(keys.begin(), keys.end(), [&](const std::pair<std::string, std::size_t>& a,
+    const std::pair<std::string, std::size_t>& b) {
+    int order = a.first.compare(b.first);
+    return order != 0 ? order < 0 : names[a.second] < names[b.second];
+  });
+  std::vector<std::string> sorted;
+  sorted.reserve(names.size());
+  for (const auto& key : keys) {sorted.push_back(std::move(names[key.second]));}
+  names.swap(sorted);
+}
 
 #endif
 
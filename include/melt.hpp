@@ -0,0 +1,183 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: melt-curve (Tm) specificity calls per well and sample
+ *
+ */
+
+#ifndef MELT
+#define MELT
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <unordered_map>
+
+#include "maths_sds.hpp"
+#include "maps_sds.hpp"
+#include "arena.hpp"
+
+// An assay's reference Tm is the median Tm of its amplified standard wells.
+// Every amplified well is compared with it; one more than `tolerance`
+// degrees away is a DEVIATION, or SECONDARY when another off-reference
+// well of the assay lies within the tolerance of it, so that together they
+// form a second cluster (e.g. primer dimers). A well is amplified when its
+// Ct is below the detection cutoff and it has a Tm; the Tm of a
+// non-amplified well (e.g. Ct 45) is noise, so such wells are NA and never
+// enter the reference. A sample is PASS when all of its wells are,
+// otherwise SECONDARY if any well is, else DEVIATION; NA when no well was
+// amplified.
+//
+// The wells are regrouped once into contiguous Ct/Tm columns ordered by
+// assay, so each assay is a single span for the comparisons. Working
+// indices and calls live in the chip's arena.
+namespace SmartchipMelt {
+  enum well_call : char {na = 0, pass = 1, deviation = 2, secondary = 3};
+
+  struct melt_calls {
+    um_str_dbl  reference_Tm;
+    um_str_dbl  group_Tm;
+    um_str_str  group_melt;
+  };
+
+  // one span per assay over the chip's wells
+  struct well_columns {
+    std::vector<float>        Ct;
+    std::vector<float>        Tm;
+    std::vector<int>          group;
+    std::vector<char>         standard;
+    std::vector<std::size_t>  assay_begin;
+    vstring                   assays;
+    vstring                   groups;
+  };
+
+  float parse_value(const std::string& field) {
+    return std::stof(field.empty() ? "NAN" : field);
+  }
+
+  well_columns gather(
+    const csv_table&    table,
+    int                 assay_column,
+    int                 sample_column,
+    int                 Ct_column,
+    int                 Tm_column,
+    const std::string&  standard_id
+  ) {
+    well_columns wells;
+    std::pmr::memory_resource* arena = SmartchipArena::resource();
+    std::pmr::unordered_map<std::string, int> assay_index(arena), group_index(arena);
+    SmartchipArena::vector<int> row_assay(table.rows.size(), arena), row_group(table.rows.size(), arena);
+    for (std::size_t i = 0; i < table.rows.size(); ++i) {
+      const std::string& assay = csv_field(table.rows[i], assay_column);
+      std::string group = assay + csv_field(table.rows[i], sample_column);
+      auto a = assay_index.emplace(assay, static_cast<int>(wells.assays.size()));
+      if (a.second) {wells.assays.push_back(assay);}
+      auto g = group_index.emplace(group, static_cast<int>(wells.groups.size()));
+      if (g.second) {wells.groups.push_back(group);}
+      row_assay[i] = a.first->second;
+      row_group[i] = g.first->second;
+    }
+    // counting sort of the rows by assay
+    wells.assay_begin.assign(wells.assays.size() + 1, 0);
+    for (int a : row_assay) {++wells.assay_begin[a + 1];}
+    for (std::size_t a = 0; a < wells.assays.size(); ++a) {wells.assay_begin[a + 1] += wells.assay_begin[a];}
+    SmartchipArena::vector<std::size_t> next(wells.assay_begin.begin(), wells.assay_begin.end() - 1, arena);
+    const std::size_t n = table.rows.size();
+    wells.Ct.resize(n);
+    wells.Tm.resize(n);
+    wells.group.resize(n);
+    wells.standard.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      std::size_t w = next[row_assay[i]]++;
+      wells.Ct[w]       = parse_value(csv_field(table.rows[i], Ct_column));
+      wells.Tm[w]       = parse_value(csv_field(table.rows[i], Tm_column));
+      wells.group[w]    = row_group[i];
+      wells.standard[w] = wells.groups[row_group[i]].find(standard_id) != std::string::npos;
+    }
+    return wells;
+  }
+
+  // NaN Cts compare false, so only a finite Ct below the cutoff counts
+  bool amplified(const well_columns& wells, std::size_t w, double detection_ct) {
+    return wells.Ct[w] < detection_ct && std::isfinite(wells.Tm[w]);
+  }
+
+  // calls for the wells in [begin, end) against `reference`
+  void call_span(const well_columns& wells, std::size_t begin, std::size_t end, double reference,
+    double tolerance, double detection_ct, SmartchipArena::vector<char>& calls, SmartchipArena::vector<float>& sorted) {
+    const float* Tm = wells.Tm.data();
+    char* call = calls.data();
+    for (std::size_t w = begin; w < end; ++w) {
+      const bool measured = amplified(wells, w, detection_ct);
+      const bool off      = std::fabs(Tm[w] - reference) > tolerance;
+      call[w] = measured * (pass + off);
+    }
+    sorted.clear();
+    for (std::size_t w = begin; w < end; ++w) {
+      if (call[w] == deviation) {sorted.push_back(Tm[w]);}
+    }
+    if (sorted.size() < 2) {return;}
+    std::sort(sorted.begin(), sorted.end());
+    // off-reference wells that cluster with another off-reference well
+    for (std::size_t w = begin; w < end; ++w) {
+      if (call[w] != deviation) {continue;}
+      auto at = std::lower_bound(sorted.begin(), sorted.end(), Tm[w]);
+      bool neighbour = (at != sorted.begin() && Tm[w] - *(at - 1) <= tolerance)
+        || (at + 1 != sorted.end() && *(at + 1) - Tm[w] <= tolerance);
+      if (neighbour) {call[w] = secondary;}
+    }
+  }
+
+  melt_calls analyze(const well_columns& wells, double tolerance, double detection_ct) {
+    melt_calls result;
+    std::pmr::memory_resource* arena = SmartchipArena::resource();
+    SmartchipArena::vector<char>   calls(wells.Tm.size(), na, arena);
+    SmartchipArena::vector<float>  scratch(arena);
+    SmartchipArena::vector<double> standard_Tm(arena);
+    for (std::size_t a = 0; a < wells.assays.size(); ++a) {
+      const std::size_t begin = wells.assay_begin[a], end = wells.assay_begin[a + 1];
+      standard_Tm.clear();
+      for (std::size_t w = begin; w < end; ++w) {
+        if (wells.standard[w] && amplified(wells, w, detection_ct)) {
+          standard_Tm.push_back(wells.Tm[w]);
+        }
+      }
+      double reference = std::numeric_limits<double>::quiet_NaN();
+      if (!standard_Tm.empty()) {
+        auto middle = standard_Tm.begin() + standard_Tm.size() / 2;
+        std::nth_element(standard_Tm.begin(), middle, standard_Tm.end());
+        reference = *middle;
+        if (standard_Tm.size() % 2 == 0) {reference = (reference + *std::max_element(standard_Tm.begin(), middle)) / 2;}
+        call_span(wells, begin, end, reference, tolerance, detection_ct, calls, scratch);
+      }
+      result.reference_Tm[wells.assays[a]] = reference;
+    }
+
+    SmartchipArena::vector<char>   worst(wells.groups.size(), na, arena);
+    SmartchipArena::vector<double> Tm_sum(wells.groups.size(), 0, arena);
+    SmartchipArena::vector<int>    Tm_count(wells.groups.size(), 0, arena);
+    for (std::size_t w = 0; w < calls.size(); ++w) {
+      const int g = wells.group[w];
+      if (calls[w] == na) {continue;}
+      worst[g] = std::max(worst[g], calls[w]);
+      Tm_sum[g]   += wells.Tm[w];
+      Tm_count[g] += 1;
+    }
+    for (std::size_t g = 0; g < wells.groups.size(); ++g) {
+      const std::string& group = wells.groups[g];
+      result.group_Tm[group] = Tm_count[g] ? Tm_sum[g] / Tm_count[g] : std::numeric_limits<double>::quiet_NaN();
+      switch (worst[g]) {
+        case pass:      result.group_melt[group] = "PASS";      break;
+        case deviation: result.group_melt[group] = "DEVIATION"; break;
+        case secondary: result.group_melt[group] = "SECONDARY"; break;
+        default:        result.group_melt[group] = "NA";
+      }
+    }
+    return result;
+  }
+}
+
+#endif // MELT
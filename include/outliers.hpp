@@ -0,0 +1,250 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: replicate outlier tests in the per-group Ct statistics
+ *
+ */
+
+#ifndef OUTLIERS
+#define OUTLIERS
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <stdexcept>
+
+#include "maths_sds.hpp"
+#include "maps_sds.hpp"
+#include "compress_sds.hpp"
+
+// Each group's replicate Cts are tested once while its mean and sd are
+// computed; a rejected replicate is set to NaN in group_Ct, so it drops out
+// of the means, standard curves and copy numbers like a missing Ct, and is
+// listed in the outlier report. Groups need at least three finite Cts.
+//
+//   grubbs  two-sided Grubbs test at `alpha`, repeated until nothing is
+//           rejected or fewer than three values remain
+//   dixon   Dixon's Q (r10) on the extreme values, n = 3..10, alpha 0.10,
+//           0.05 or 0.01 (Rorabacher 1991)
+//   mad     |x - median| / (1.4826 MAD) > 3.5 (Iglewicz and Hoaglin)
+namespace SmartchipOutliers {
+  enum class method {none, grubbs, dixon, mad};
+
+  method parse_method(const std::string& name) {
+    if (name == "none")   {return method::none;}
+    if (name == "grubbs") {return method::grubbs;}
+    if (name == "dixon")  {return method::dixon;}
+    if (name == "mad")    {return method::mad;}
+    throw std::invalid_argument("unknown outlier test '" + name + "' (use none, grubbs, dixon or mad).");
+  }
+
+  std::string method_name(method test) {
+    switch (test) {
+      case method::grubbs: return "grubbs";
+      case method::dixon:  return "dixon";
+      case method::mad:    return "mad";
+      default:             return "none";
+    }
+  }
+
+  struct rejected_well {
+    std::string group;
+    int         replicate;
+    double      Ct;
+    double      statistic;
+    double      critical;
+  };
+
+  // regularized incomplete beta I_x(a, b) by its continued fraction
+  double regularized_beta(double a, double b, double x) {
+    if (x <= 0) {return 0;}
+    if (x >= 1) {return 1;}
+    if (x > (a + 1) / (a + b + 2)) {return 1 - regularized_beta(b, a, 1 - x);}
+    const double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b)
+      + a * std::log(x) + b * std::log(1 - x)) / a;
+    const double tiny = 1e-300;
+    double f = 1, c = 1, d = 1 - (a + b) * x / (a + 1);
+    d = std::fabs(d) < tiny ? 1 / tiny : 1 / d;
+    f = d;
+    for (int m = 1; m <= 200; ++m) {
+      for (int odd = 0; odd < 2; ++odd) {
+        double numerator = odd
+          ? -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))
+          : m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+        d = 1 + numerator * d;
+        d = std::fabs(d) < tiny ? 1 / tiny : 1 / d;
+        c = 1 + numerator / c;
+        if (std::fabs(c) < tiny) {c = tiny;}
+        f *= c * d;
+      }
+      if (std::fabs(c * d - 1) < 1e-12) {break;}
+    }
+    return front * f;
+  }
+
+  // upper quantile t with P(T > t) = p for Student's t on `dof` degrees
+  double t_upper_quantile(double p, double dof) {
+    double low = 0, high = 1e4;
+    for (int i = 0; i < 200; ++i) {
+      const double t = (low + high) / 2;
+      const double tail = 0.5 * regularized_beta(dof / 2, 0.5, dof / (dof + t * t));
+      (tail > p ? low : high) = t;
+    }
+    return (low + high) / 2;
+  }
+
+  double grubbs_critical(int n, double alpha) {
+    const double t = t_upper_quantile(alpha / (2 * n), n - 2);
+    return (n - 1) / std::sqrt(n) * std::sqrt(t * t / (n - 2 + t * t));
+  }
+
+  double dixon_critical(int n, double alpha) {
+    static const double q90[] = {0.941, 0.765, 0.642, 0.560, 0.507, 0.468, 0.437, 0.412};
+    static const double q95[] = {0.970, 0.829, 0.710, 0.625, 0.568, 0.526, 0.493, 0.466};
+    static const double q99[] = {0.994, 0.926, 0.821, 0.740, 0.680, 0.634, 0.598, 0.568};
+    if (n < 3 || n > 10) {return std::numeric_limits<double>::quiet_NaN();}
+    const double* table = std::fabs(alpha - 0.10) < 1e-9 ? q90 : std::fabs(alpha - 0.01) < 1e-9 ? q99 : q95;
+    return table[n - 3];
+  }
+
+  void validate(method test, double alpha) {
+    if (!(alpha > 0 && alpha < 1)) {throw std::invalid_argument("outlier alpha must be between 0 and 1.");}
+    if (test == method::dixon && std::fabs(alpha - 0.10) > 1e-9 && std::fabs(alpha - 0.05) > 1e-9
+      && std::fabs(alpha - 0.01) > 1e-9) {
+      throw std::invalid_argument("the Dixon test takes alpha 0.10, 0.05 or 0.01.");
+    }
+  }
+
+  class tester {
+    public:
+      tester(method test, double alpha) : test(test), alpha(alpha) {}
+
+      // rejects outliers among `values` (in place, as NaN), then gives the
+      // mean and sd of what is left
+      void run(const std::string& group, vdouble& values, double& mean_out, double& sd_out,
+        std::vector<rejected_well>& rejected) {
+        if (test != method::none) {
+          bool again = true;
+          while (again) {
+            again = false;
+            finite.clear();
+            for (std::size_t i = 0; i < values.size(); ++i) {
+              if (std::isfinite(values[i])) {finite.push_back(i);}
+            }
+            const int n = static_cast<int>(finite.size());
+            if (n < 3) {break;}
+            if (test == method::grubbs) {again = grubbs(group, values, n, rejected);}
+            else if (test == method::dixon) {dixon(group, values, n, rejected);}
+            else {mad(group, values, n, rejected);}
+          }
+        }
+        double sum = 0, squares = 0;
+        int n = 0;
+        for (double v : values) {
+          if (std::isnan(v)) {continue;}
+          sum += v;
+          ++n;
+        }
+        mean_out = n ? sum / n : std::numeric_limits<double>::quiet_NaN();
+        for (double v : values) {
+          if (!std::isnan(v)) {squares += (v - mean_out) * (v - mean_out);}
+        }
+        sd_out = n > 1 ? std::sqrt(squares / (n - 1)) : std::numeric_limits<double>::quiet_NaN();
+      }
+
+    private:
+      method                    test;
+      double                    alpha;
+      std::vector<std::size_t>  finite;
+      std::vector<double>       scratch;
+      std::vector<double>       grubbs_cache;
+
+      void reject(const std::string& group, vdouble& values, std::size_t i, double statistic,
+        double critical, std::vector<rejected_well>& rejected) {
+        rejected.push_back(rejected_well{group, static_cast<int>(i) + 1, values[i], statistic, critical});
+        values[i] = std::numeric_limits<double>::quiet_NaN();
+      }
+
+      bool grubbs(const std::string& group, vdouble& values, int n, std::vector<rejected_well>& rejected) {
+        double sum = 0, squares = 0;
+        for (std::size_t i : finite) {sum += values[i];}
+        const double centre = sum / n;
+        for (std::size_t i : finite) {squares += (values[i] - centre) * (values[i] - centre);}
+        const double s = std::sqrt(squares / (n - 1));
+        if (!(s > 0)) {return false;}
+        std::size_t extreme = finite[0];
+        for (std::size_t i : finite) {
+          if (std::fabs(values[i] - centre) > std::fabs(values[extreme] - centre)) {extreme = i;}
+        }
+        if (grubbs_cache.size() <= static_cast<std::size_t>(n)) {
+          grubbs_cache.resize(n + 1, std::numeric_limits<double>::quiet_NaN());
+        }
+        if (std::isnan(grubbs_cache[n])) {grubbs_cache[n] = grubbs_critical(n, alpha);}
+        const double G = std::fabs(values[extreme] - centre) / s;
+        if (G <= grubbs_cache[n]) {return false;}
+        reject(group, values, extreme, G, grubbs_cache[n], rejected);
+        return true;
+      }
+
+      void dixon(const std::string& group, vdouble& values, int n, std::vector<rejected_well>& rejected) {
+        const double critical = dixon_critical(n, alpha);
+        if (std::isnan(critical)) {return;}
+        auto by_value = [&](std::size_t a, std::size_t b) {return values[a] < values[b];};
+        std::sort(finite.begin(), finite.end(), by_value);
+        const double range = values[finite[n - 1]] - values[finite[0]];
+        if (!(range > 0)) {return;}
+        const double Q_low  = (values[finite[1]] - values[finite[0]]) / range;
+        const double Q_high = (values[finite[n - 1]] - values[finite[n - 2]]) / range;
+        const bool   high   = Q_high >= Q_low;
+        const double Q      = high ? Q_high : Q_low;
+        if (Q > critical) {reject(group, values, high ? finite[n - 1] : finite[0], Q, critical, rejected);}
+      }
+
+      void mad(const std::string& group, vdouble& values, int n, std::vector<rejected_well>& rejected) {
+        auto median = [&]() {
+          auto middle = scratch.begin() + n / 2;
+          std::nth_element(scratch.begin(), middle, scratch.end());
+          double upper = *middle;
+          return n % 2 ? upper : (upper + *std::max_element(scratch.begin(), middle)) / 2;
+        };
+        scratch.clear();
+        for (std::size_t i : finite) {scratch.push_back(values[i]);}
+        const double centre = median();
+        scratch.clear();
+        for (std::size_t i : finite) {scratch.push_back(std::fabs(values[i] - centre));}
+        const double scale = 1.4826 * median();
+        if (!(scale > 0)) {return;}
+        for (std::size_t i : finite) {
+          const double z = std::fabs(values[i] - centre) / scale;
+          if (z > 3.5) {reject(group, values, i, z, 3.5, rejected);}
+        }
+      }
+  };
+
+  void write_report(
+    const std::string&                  output,
+    const std::vector<rejected_well>&   rejected,
+    const um_str_str&                   group_assay,
+    const um_str_str&                   group_sample,
+    method                              test
+  ) {
+    std::unique_ptr<std::ostream> outlier_stream = SdsCompress::open_output(output + "_outlier_report.csv");
+    std::ostream& outlier_file = *outlier_stream;
+    outlier_file << "Assay,Sample,Replicate,Ct,Test,Statistic,Critical_value\n";
+    for (const auto& well : rejected) {
+      outlier_file
+        << um_at(group_assay, well.group) << ","
+        << um_at(group_sample, well.group) << ","
+        << well.replicate << ","
+        << well.Ct << ","
+        << method_name(test) << ","
+        << well.statistic << ","
+        << well.critical << "\n";
+    }
+  }
+}
+
+#endif // OUTLIERS
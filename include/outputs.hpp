@@ -8,6 +8,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
 #include <iterator>
@@ -18,31 +19,62 @@
 #include <regex>
 #include <numeric>
 #include <cmath>
+#include <queue>
+#include <memory>
 
 #include "maths_sds.hpp"
 #include "maps_sds.hpp"
 #include "defs_sds.hpp"
+#include "compress_sds.hpp"
+#include "detection.hpp"
+#include "arena.hpp"
 
 #ifndef OUTPUTS
 #define OUTPUTS
 
 
-void create_assay_report(
-  std::string output,
-  vstring     assays,
-  um_str_dbl  std_efficiency_map,
-  um_str_pair_dbl_dbl regression_map,
-  um_str_dbl  rsqr_map,
-  um_str_str  std_QC,
-  um_str_dbl  NEG_means,
-  um_str_str  QC_NEG,
-  um_str_dbl  NTC_means,
-  um_str_dbl  STD_means,
-  um_str_str  QC_NTC,
-  um_str_dbl  Ct_perc_below
-) {
-  std::ofstream assay_report_file(output + "_assay_QC_report.csv");
-  assay_report_file 
+// Report rows are rendered separately from the files they go into, so the
+// same rows can be written per chip or merged across chips. Each row carries
+// the assay or group key it is sorted by.
+struct report_rows {
+  vstring keys;
+  vstring rows;
+};
+
+struct chip_reports {
+  std::string chip;
+  bool        limits = false;
+  bool        melt   = false;
+  report_rows assay;
+  report_rows LIMS;
+  report_rows full;
+  report_rows detection;
+};
+
+// mean and sd of a group's copy numbers, computed as mean() and sd() do but
+// on one scratch copy of the finite values taken from the chip's arena
+struct copy_stats {
+  double mean;
+  double sd;
+};
+
+copy_stats copy_number_stats(const vdouble& copies) {
+  SmartchipArena::vector<double> kept(SmartchipArena::resource());
+  kept.reserve(copies.size());
+  for (double copy : copies) {
+    if (copy == copy) {kept.push_back(copy);}
+  }
+  if (kept.empty()) {kept.push_back(NAN);}
+  const int n = static_cast<int>(kept.size());
+  const double mean = std::accumulate(kept.begin(), kept.end(), 0.0) / n;
+  double variance = 0;
+  for (double copy : kept) {variance += std::pow((copy - mean), 2);}
+  return {mean, std::sqrt(variance / (n - 1))};
+}
+
+std::string assay_report_header() {
+  std::ostringstream header;
+  header 
     << "Assay" << ","
     << "STD_Efficiency" << ","
     << "Slope" << ","
@@ -54,32 +86,77 @@ void create_assay_report(
     << "NTC_diff" << ","
     << "QC_NTC" << ","
     << "Percent_Positive_Samples" << "\n";
-  for (auto assay : assays) {
-    assay_report_file 
+  return header.str();
+}
+
+report_rows assay_report_rows(
+  const vstring&             assays,
+  const um_str_dbl&          std_efficiency_map,
+  const um_str_pair_dbl_dbl& regression_map,
+  const um_str_dbl&          rsqr_map,
+  const um_str_str&          std_QC,
+  const um_str_dbl&          NEG_means,
+  const um_str_str&          QC_NEG,
+  const um_str_dbl&          NTC_means,
+  const um_str_dbl&          STD_means,
+  const um_str_str&          QC_NTC,
+  const um_str_dbl&          Ct_perc_below
+) {
+  report_rows report;
+  std::ostringstream row;
+  for (const auto& assay : assays) {
+    row.str("");
+    row 
       << assay << ","
-      << std_efficiency_map[assay] << ","
-      << regression_map[assay].second << ","
-      << regression_map[assay].first << ","
-      << rsqr_map[assay] << ","
-      << std_QC[assay] << ","
-      << NEG_means[assay] << ","
-      << QC_NEG[assay] << ","
-      << NTC_means[assay] - STD_means[assay] << ","
-      << QC_NTC[assay] << ","
-      << std::round(Ct_perc_below[assay]*100) << "\n";
+      << um_at(std_efficiency_map, assay) << ","
+      << um_at(regression_map, assay).second << ","
+      << um_at(regression_map, assay).first << ","
+      << um_at(rsqr_map, assay) << ","
+      << um_at(std_QC, assay) << ","
+      << um_at(NEG_means, assay) << ","
+      << um_at(QC_NEG, assay) << ","
+      << um_at(NTC_means, assay) - um_at(STD_means, assay) << ","
+      << um_at(QC_NTC, assay) << ","
+      << std::round(um_at(Ct_perc_below, assay)*100) << "\n";
+    report.keys.push_back(assay);
+    report.rows.push_back(row.str());
   }
+  return report;
+}
+
+void create_assay_report(
+  const std::string&         output,
+  const vstring&             assays,
+  const um_str_dbl&          std_efficiency_map,
+  const um_str_pair_dbl_dbl& regression_map,
+  const um_str_dbl&          rsqr_map,
+  const um_str_str&          std_QC,
+  const um_str_dbl&          NEG_means,
+  const um_str_str&          QC_NEG,
+  const um_str_dbl&          NTC_means,
+  const um_str_dbl&          STD_means,
+  const um_str_str&          QC_NTC,
+  const um_str_dbl&          Ct_perc_below
+) {
+  std::unique_ptr<std::ostream> assay_report_stream = SdsCompress::open_output(output + "_assay_QC_report.csv");
+  std::ostream& assay_report_file = *assay_report_stream;
+  assay_report_file << assay_report_header();
+  report_rows report = assay_report_rows(assays, std_efficiency_map, regression_map, rsqr_map,
+    std_QC, NEG_means, QC_NEG, NTC_means, STD_means, QC_NTC, Ct_perc_below);
+  for (const auto& row : report.rows) {assay_report_file << row;}
 }
 
 void create_sample_report(
-  std::string output,
-  vstring     groupID,
-  um_str_str  group_QC,
-  um_str_str  group_assay,
-  um_str_str  group_sample,
-  um_str_vdbl group_copyN,
-  um_str_dbl  group_efficiency
+  const std::string& output,
+  const vstring&     groupID,
+  const um_str_str&  group_QC,
+  const um_str_str&  group_assay,
+  const um_str_str&  group_sample,
+  const um_str_vdbl& group_copyN,
+  const um_str_dbl&  group_efficiency
 ) {   
-  std::ofstream sample_report_file(output + "_sample_QC_report.csv");
+  std::unique_ptr<std::ostream> sample_report_stream = SdsCompress::open_output(output + "_sample_QC_report.csv");
+  std::ostream& sample_report_file = *sample_report_stream;
   sample_report_file 
     << "Assay," 
     << "Sample," 
@@ -88,30 +165,22 @@ void create_sample_report(
     << "Mean_Efficiency," 
     << "QCSample," 
     << "\n";
-  for (auto group : groupID) {
+  for (const auto& group : groupID) {
+    copy_stats stats = copy_number_stats(um_at(group_copyN, group));
     sample_report_file 
-      << group_assay[group] << ","
-      << group_sample[group] << ","
-      << mean(group_copyN[group]) << ","
-      << sd(group_copyN[group]) << ","
-      << group_efficiency[group] << ","
-      << group_QC[group] 
+      << um_at(group_assay, group) << ","
+      << um_at(group_sample, group) << ","
+      << stats.mean << ","
+      << stats.sd << ","
+      << um_at(group_efficiency, group) << ","
+      << um_at(group_QC, group) 
       << "\n";
   }
 }
 
-void create_LIMS_report(
-  std::string output,
-  vstring     groupID,
-  um_str_str  group_QC,
-  um_str_str  group_assay,
-  um_str_str  group_sample,
-  um_str_vdbl group_copyN,
-  um_str_dbl  group_efficiency
-) {   
-  std::ofstream LIMS_report_file(output + "_LIMS_report.csv");
-  int row = 0;
-  LIMS_report_file 
+std::string LIMS_report_header(bool melt = false) {
+  std::ostringstream header;
+  header 
     << ","
     << "Number,"
     << "Assay,"
@@ -125,46 +194,76 @@ void create_LIMS_report(
     << "stderr_CopyN," 
     << "Mean_Efficiency," 
     << "QCSample," 
+    << (melt ? "Mean_Tm,QC_Melt," : "")
     << "\n";
-  for (auto group : groupID) {
-    ++row;
-    LIMS_report_file
-      << row
-      << ","
+  return header.str();
+}
+
+// LIMS rows are stored without their leading row number, which is assigned
+// when the rows are written. group_melt adds Mean_Tm and QC_Melt columns
+// when melt calls were made.
+report_rows LIMS_report_rows(
+  const vstring&     groupID,
+  const um_str_str&  group_QC,
+  const um_str_str&  group_assay,
+  const um_str_str&  group_sample,
+  const um_str_vdbl& group_copyN,
+  const um_str_dbl&  group_efficiency,
+  const um_str_dbl&  group_Tm = um_str_dbl(),
+  const um_str_str&  group_melt = um_str_str()
+) {
+  report_rows report;
+  std::ostringstream row;
+  for (const auto& group : groupID) {
+    copy_stats stats = copy_number_stats(um_at(group_copyN, group));
+    row.str("");
+    row
       << ","
       << ","
       << ","
       << ","
-      << group_assay[group] << ","
+      << um_at(group_assay, group) << ","
       << ","
-      << group_sample[group] << ","
-      << mean(group_copyN[group]) << ","
-      << sd(group_copyN[group]) << ","
-      << group_efficiency[group] << ","
-      << group_QC[group] 
+      << um_at(group_sample, group) << ","
+      << stats.mean << ","
+      << stats.sd << ","
+      << um_at(group_efficiency, group) << ","
+      << um_at(group_QC, group);
+    if (!group_melt.empty()) {row << "," << um_at(group_Tm, group) << "," << um_at(group_melt, group);}
+    row
       << "\n";
+    report.keys.push_back(group);
+    report.rows.push_back(row.str());
   }
+  return report;
 }
 
-void create_full_report(
-  std::string output,
-  vstring     groupID,
-  um_str_str  group_QC,
-  um_str_str  group_assay,
-  um_str_str  group_sample,
-  um_str_vdbl group_copyN,
-  um_str_dbl  group_efficiency,
-  um_str_dbl  std_efficiency_map,
-  um_str_dbl  rsqr_map,
-  um_str_str  std_QC,
-  um_str_dbl  NEG_means,
-  um_str_str  QC_NEG,
-  um_str_dbl  NTC_means,
-  um_str_dbl  STD_means,
-  um_str_str  QC_NTC
+void create_LIMS_report(
+  const std::string& output,
+  const vstring&     groupID,
+  const um_str_str&  group_QC,
+  const um_str_str&  group_assay,
+  const um_str_str&  group_sample,
+  const um_str_vdbl& group_copyN,
+  const um_str_dbl&  group_efficiency,
+  const um_str_dbl&  group_Tm = um_str_dbl(),
+  const um_str_str&  group_melt = um_str_str()
 ) {   
-  std::ofstream all_report_file(output + "_sample_qpcr_output_with_assay_info_qc.csv");
-  all_report_file 
+  std::unique_ptr<std::ostream> LIMS_report_stream = SdsCompress::open_output(output + "_LIMS_report.csv");
+  std::ostream& LIMS_report_file = *LIMS_report_stream;
+  int row = 0;
+  LIMS_report_file << LIMS_report_header(!group_melt.empty());
+  report_rows report = LIMS_report_rows(groupID, group_QC, group_assay, group_sample,
+    group_copyN, group_efficiency, group_Tm, group_melt);
+  for (const auto& line : report.rows) {
+    ++row;
+    LIMS_report_file << row << "," << line;
+  }
+}
+
+std::string full_report_header(bool limits = false, bool melt = false) {
+  std::ostringstream header;
+  header 
     << "Assay," 
     << "Sample," 
     << "Mean_Copy_N," 
@@ -178,56 +277,257 @@ void create_full_report(
     << "QC_NEG," 
     << "NTC_diff," 
     << "QC_NTC," 
+    << (limits ? "QC_LOQ," : "")
+    << (melt ? "Mean_Tm,QC_Melt," : "")
     << "\n";
-  for (auto group : groupID) {
-    std::string assay = group_assay[group];
-    all_report_file 
+  return header.str();
+}
+
+// group_LOQ adds a QC_LOQ column when detection limits were estimated, and
+// group_melt Mean_Tm and QC_Melt columns when melt calls were made
+report_rows full_report_rows(
+  const vstring&     groupID,
+  const um_str_str&  group_QC,
+  const um_str_str&  group_assay,
+  const um_str_str&  group_sample,
+  const um_str_vdbl& group_copyN,
+  const um_str_dbl&  group_efficiency,
+  const um_str_dbl&  std_efficiency_map,
+  const um_str_dbl&  rsqr_map,
+  const um_str_str&  std_QC,
+  const um_str_dbl&  NEG_means,
+  const um_str_str&  QC_NEG,
+  const um_str_dbl&  NTC_means,
+  const um_str_dbl&  STD_means,
+  const um_str_str&  QC_NTC,
+  const um_str_str&  group_LOQ = um_str_str(),
+  const um_str_dbl&  group_Tm = um_str_dbl(),
+  const um_str_str&  group_melt = um_str_str()
+) {
+  report_rows report;
+  std::ostringstream row;
+  for (const auto& group : groupID) {
+    const std::string& assay = um_at(group_assay, group);
+    copy_stats stats = copy_number_stats(um_at(group_copyN, group));
+    row.str("");
+    row 
       << assay << ","
-      << group_sample[group] << ","
-      << mean(group_copyN[group]) << ","
-      << sd(group_copyN[group]) << ","
-      << group_efficiency[group] << ","
-      << group_QC[group] << ","
-      << std_efficiency_map[assay] << ","
-      << rsqr_map[assay] << ","
-      << std_QC[assay] << ","
-      << NEG_means[assay] << ","
-      << QC_NEG[assay] << ","
-      << NTC_means[assay] - STD_means[assay] << ","
-      << QC_NTC[assay] 
+      << um_at(group_sample, group) << ","
+      << stats.mean << ","
+      << stats.sd << ","
+      << um_at(group_efficiency, group) << ","
+      << um_at(group_QC, group) << ","
+      << um_at(std_efficiency_map, assay) << ","
+      << um_at(rsqr_map, assay) << ","
+      << um_at(std_QC, assay) << ","
+      << um_at(NEG_means, assay) << ","
+      << um_at(QC_NEG, assay) << ","
+      << um_at(NTC_means, assay) - um_at(STD_means, assay) << ","
+      << um_at(QC_NTC, assay);
+    if (!group_LOQ.empty()) {row << "," << um_at(group_LOQ, group);}
+    if (!group_melt.empty()) {row << "," << um_at(group_Tm, group) << "," << um_at(group_melt, group);}
+    row
       << "\n";
+    report.keys.push_back(group);
+    report.rows.push_back(row.str());
   }
+  return report;
+}
+
+void create_full_report(
+  const std::string& output,
+  const vstring&     groupID,
+  const um_str_str&  group_QC,
+  const um_str_str&  group_assay,
+  const um_str_str&  group_sample,
+  const um_str_vdbl& group_copyN,
+  const um_str_dbl&  group_efficiency,
+  const um_str_dbl&  std_efficiency_map,
+  const um_str_dbl&  rsqr_map,
+  const um_str_str&  std_QC,
+  const um_str_dbl&  NEG_means,
+  const um_str_str&  QC_NEG,
+  const um_str_dbl&  NTC_means,
+  const um_str_dbl&  STD_means,
+  const um_str_str&  QC_NTC,
+  const um_str_str&  group_LOQ = um_str_str(),
+  const um_str_dbl&  group_Tm = um_str_dbl(),
+  const um_str_str&  group_melt = um_str_str()
+) {   
+  std::unique_ptr<std::ostream> all_report_stream = SdsCompress::open_output(output + "_sample_qpcr_output_with_assay_info_qc.csv");
+  std::ostream& all_report_file = *all_report_stream;
+  all_report_file << full_report_header(!group_LOQ.empty(), !group_melt.empty());
+  report_rows report = full_report_rows(groupID, group_QC, group_assay, group_sample,
+    group_copyN, group_efficiency, std_efficiency_map, rsqr_map,
+    std_QC, NEG_means, QC_NEG, NTC_means, STD_means, QC_NTC, group_LOQ, group_Tm, group_melt);
+  for (const auto& row : report.rows) {all_report_file << row;}
 }
 
 void create_reports(
-  std::string output,
-  vstring     assays,
-  vstring     groupID,
-  um_str_str  group_QC,
-  um_str_str  group_assay,
-  um_str_str  group_sample,
-  um_str_vdbl group_copyN,
-  um_str_dbl  Ct_perc_below,
-  um_str_pair_dbl_dbl regression_map,
-  um_str_dbl  group_efficiency,
-  um_str_dbl  std_efficiency_map,
-  um_str_dbl  rsqr_map,
-  um_str_str  std_QC,
-  um_str_dbl  NEG_means,
-  um_str_str  QC_NEG,
-  um_str_dbl  NTC_means,
-  um_str_dbl  STD_means,
-  um_str_str  QC_NTC
+  const std::string&         output,
+  const vstring&             assays,
+  const vstring&             groupID,
+  const um_str_str&          group_QC,
+  const um_str_str&          group_assay,
+  const um_str_str&          group_sample,
+  const um_str_vdbl&         group_copyN,
+  const um_str_dbl&          Ct_perc_below,
+  const um_str_pair_dbl_dbl& regression_map,
+  const um_str_dbl&          group_efficiency,
+  const um_str_dbl&          std_efficiency_map,
+  const um_str_dbl&          rsqr_map,
+  const um_str_str&          std_QC,
+  const um_str_dbl&          NEG_means,
+  const um_str_str&          QC_NEG,
+  const um_str_dbl&          NTC_means,
+  const um_str_dbl&          STD_means,
+  const um_str_str&          QC_NTC,
+  const um_str_str&          group_LOQ = um_str_str(),
+  const um_str_dbl&          group_Tm = um_str_dbl(),
+  const um_str_str&          group_melt = um_str_str()
 ) {
   create_assay_report(output, assays, std_efficiency_map, regression_map, rsqr_map, 
     std_QC, NEG_means, QC_NEG, NTC_means, STD_means, QC_NTC, Ct_perc_below);
   // create_sample_report(output, groupID, group_QC, group_assay, group_sample,
   //     group_copyN, group_efficiency);
   create_LIMS_report(output, groupID, group_QC, group_assay, group_sample,
-    group_copyN, group_efficiency);
+    group_copyN, group_efficiency, group_Tm, group_melt);
   create_full_report(output, groupID, group_QC, group_assay, group_sample, 
     group_copyN, group_efficiency, std_efficiency_map, rsqr_map, 
-    std_QC, NEG_means, QC_NEG, NTC_means, STD_means, QC_NTC);
+    std_QC, NEG_means, QC_NEG, NTC_means, STD_means, QC_NTC, group_LOQ, group_Tm, group_melt);
+}
+
+// A standard well that a robust curve fit gave reduced weight.
+struct well_weight {
+  std::string group;
+  int         replicate;
+  double      log_abundance;
+  double      Ct;
+  double      weight;
+};
+
+void create_robust_fit_report(
+  std::string output,
+  const vstring& assays,
+  const std::unordered_map<std::string, std::vector<well_weight> >& downweighted
+) {
+  std::unique_ptr<std::ostream> robust_report_stream = SdsCompress::open_output(output + "_robust_fit_report.csv");
+  std::ostream& robust_report_file = *robust_report_stream;
+  robust_report_file << "Assay,Group,Replicate,log_abundance,Ct,Weight\n";
+  for (const auto& assay : assays) {
+    auto wells = downweighted.find(assay);
+    if (wells == downweighted.end()) {continue;}
+    for (const auto& well : wells->second) {
+      robust_report_file << assay << "," << well.group << "," << well.replicate << ","
+        << well.log_abundance << "," << well.Ct << "," << well.weight << "\n";
+    }
+  }
+}
+
+std::string detection_report_header() {
+  return "Assay,Detection_Ct,LOD_log,LOD_copies,LOQ_log,LOQ_copies,LOD_method\n";
+}
+
+report_rows detection_report_rows(
+  const vstring& assays,
+  const std::unordered_map<std::string, SmartchipDetection::detection_limits>& limits,
+  const um_str_flo& gene_magnitudes
+) {
+  report_rows report;
+  std::ostringstream row;
+  for (const auto& assay : assays) {
+    auto found = limits.find(assay);
+    if (found == limits.end()) {continue;}
+    const SmartchipDetection::detection_limits& limit = found->second;
+    auto magnitude = gene_magnitudes.find(assay);
+    double coefficient = magnitude != gene_magnitudes.end() ? magnitude->second : 1;
+    row.str("");
+    row << assay << "," << limit.detection_ct << ","
+      << limit.lod << "," << coefficient * std::pow(10, limit.lod) << ","
+      << limit.loq << "," << coefficient * std::pow(10, limit.loq) << ","
+      << limit.method << "\n";
+    report.keys.push_back(assay);
+    report.rows.push_back(row.str());
+  }
+  return report;
+}
+
+void create_detection_report(
+  std::string output,
+  const vstring& assays,
+  const std::unordered_map<std::string, SmartchipDetection::detection_limits>& limits,
+  const um_str_flo& gene_magnitudes
+) {
+  std::unique_ptr<std::ostream> detection_report_stream = SdsCompress::open_output(output + "_LOD_LOQ_report.csv");
+  std::ostream& detection_report_file = *detection_report_stream;
+  detection_report_file << detection_report_header();
+  report_rows report = detection_report_rows(assays, limits, gene_magnitudes);
+  for (const auto& row : report.rows) {detection_report_file << row;}
+}
+
+// k-way merge of per-chip rows that are each already sorted by key; ties go
+// to the earlier chip, so rows for one assay or group stay in chip order.
+void merge_report_rows(
+  std::ostream&                     out,
+  std::vector<chip_reports>&        chips,
+  report_rows chip_reports::*       report,
+  bool                              numbered
+) {
+  typedef std::pair<std::size_t, std::size_t> cursor;
+  // collation keys once per row, in the order extract sorted the rows
+  std::vector<vstring> collation(chips.size());
+  for (std::size_t c = 0; c < chips.size(); ++c) {
+    for (const auto& key : (chips[c].*report).keys) {collation[c].push_back(collation_key(key));}
+  }
+  auto later = [&](const cursor& a, const cursor& b) {
+    int order = collation[a.first][a.second].compare(collation[b.first][b.second]);
+    if (order == 0) {
+      order = (chips[a.first].*report).keys[a.second].compare((chips[b.first].*report).keys[b.second]);
+    }
+    if (order != 0) {return order > 0;}
+    return a.first > b.first;
+  };
+  std::priority_queue<cursor, std::vector<cursor>, decltype(later)> heads(later);
+  for (std::size_t c = 0; c < chips.size(); ++c) {
+    if (!(chips[c].*report).rows.empty()) {heads.push({c, 0});}
+  }
+  int row = 0;
+  while (!heads.empty()) {
+    cursor head = heads.top();
+    heads.pop();
+    const report_rows& rows = chips[head.first].*report;
+    out << chips[head.first].chip << ",";
+    if (numbered) {out << ++row << ",";}
+    out << rows.rows[head.second];
+    if (head.second + 1 < rows.rows.size()) {heads.push({head.first, head.second + 1});}
+  }
+}
+
+// One assay QC, LIMS and full report (and LOD/LOQ report, with --lod) for
+// a set of chips, with the chip identifier as the first column.
+void create_consolidated_reports(std::string output, std::vector<chip_reports>& chips) {
+  std::unique_ptr<std::ostream> assay_report_stream = SdsCompress::open_output(output + "_assay_QC_report.csv");
+  std::ostream& assay_report_file = *assay_report_stream;
+  assay_report_file << "Chip," << assay_report_header();
+  merge_report_rows(assay_report_file, chips, &chip_reports::assay, false);
+
+  std::unique_ptr<std::ostream> LIMS_report_stream = SdsCompress::open_output(output + "_LIMS_report.csv");
+  std::ostream& LIMS_report_file = *LIMS_report_stream;
+  LIMS_report_file << "Chip," << LIMS_report_header(!chips.empty() && chips.front().melt);
+  merge_report_rows(LIMS_report_file, chips, &chip_reports::LIMS, true);
+
+  std::unique_ptr<std::ostream> all_report_stream = SdsCompress::open_output(output + "_sample_qpcr_output_with_assay_info_qc.csv");
+  std::ostream& all_report_file = *all_report_stream;
+  all_report_file << "Chip," << full_report_header(!chips.empty() && chips.front().limits,
+    !chips.empty() && chips.front().melt);
+  merge_report_rows(all_report_file, chips, &chip_reports::full, false);
+
+  if (!chips.empty() && chips.front().limits) {
+    std::unique_ptr<std::ostream> detection_report_stream = SdsCompress::open_output(output + "_LOD_LOQ_report.csv");
+    std::ostream& detection_report_file = *detection_report_stream;
+    detection_report_file << "Chip," << detection_report_header();
+    merge_report_rows(detection_report_file, chips, &chip_reports::detection, false);
+  }
 }
 
 #endif
\ No newline at end of file
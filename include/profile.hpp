@@ -0,0 +1,271 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: stage-level timing and memory instrumentation
+ *
+ */
+
+#ifndef PROFILE
+#define PROFILE
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cstdio>
+#include <new>
+#include <cstdlib>
+#ifndef _WIN32
+  #include <sys/resource.h>
+  #include <time.h>
+#endif
+
+// Counters are thread_local so that stages running on different threads only
+// see their own reads and allocations. Peak RSS is the process-wide high-water
+// mark when a stage closes, not a per-chip figure: it never decreases, and
+// under -j it includes every chip running alongside.
+namespace SmartchipProfile {
+  thread_local unsigned long long bytes_read      = 0;
+  thread_local unsigned long long rows_parsed     = 0;
+  thread_local unsigned long long allocations     = 0;
+  thread_local unsigned long long bytes_allocated = 0;
+
+  struct StageRecord {
+    std::string         chip;
+    std::string         stage;
+    int                 depth;
+    std::size_t         thread;
+    double              start_us;
+    double              wall_ms;
+    double              cpu_ms;
+    unsigned long long  bytes_read;
+    unsigned long long  rows_parsed;
+    unsigned long long  allocations;
+    unsigned long long  bytes_allocated;
+    long                process_peak_rss_kb;
+  };
+
+  bool                      enabled = false;
+  std::atomic<bool>         counting_allocations(false);
+  std::mutex                records_mutex;
+  std::vector<StageRecord>  records;
+  thread_local int          depth = 0;
+  const auto                epoch = std::chrono::steady_clock::now();
+
+  void count_allocations() {counting_allocations.store(true, std::memory_order_relaxed);}
+
+  void enable() {
+    enabled = true;
+    count_allocations();
+  }
+
+  void record_read(std::size_t bytes) {
+    bytes_read += bytes;
+    ++rows_parsed;
+  }
+
+  double cpu_time_ms() {
+    #ifdef _WIN32
+      return 1000.0 * std::clock() / CLOCKS_PER_SEC;
+    #else
+      timespec ts;
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+      return ts.tv_sec * 1000.0 + ts.tv_nsec / 1.0e6;
+    #endif
+  }
+
+  long process_peak_rss_kb() {
+    #ifdef _WIN32
+      return 0;
+    #else
+      rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+      return usage.ru_maxrss;
+    #endif
+  }
+
+  double elapsed_us() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+  }
+
+  class ScopedStage {
+    public:
+      ScopedStage(const std::string& chip, const std::string& stage) : active(enabled) {
+        if (!active) {return;}
+        record.chip             = chip;
+        record.stage            = stage;
+        record.depth            = depth++;
+        record.thread           = std::hash<std::thread::id>()(std::this_thread::get_id());
+        record.start_us         = elapsed_us();
+        record.bytes_read       = bytes_read;
+        record.rows_parsed      = rows_parsed;
+        record.allocations      = allocations;
+        record.bytes_allocated  = bytes_allocated;
+        cpu_start               = cpu_time_ms();
+      }
+      ~ScopedStage() {
+        if (!active) {return;}
+        --depth;
+        record.wall_ms          = (elapsed_us() - record.start_us) / 1000.0;
+        record.cpu_ms           = cpu_time_ms() - cpu_start;
+        record.bytes_read       = bytes_read - record.bytes_read;
+        record.rows_parsed      = rows_parsed - record.rows_parsed;
+        record.allocations      = allocations - record.allocations;
+        record.bytes_allocated  = bytes_allocated - record.bytes_allocated;
+        record.process_peak_rss_kb = process_peak_rss_kb();
+        std::lock_guard<std::mutex> lock(records_mutex);
+        records.push_back(record);
+      }
+      ScopedStage(const ScopedStage&) = delete;
+      ScopedStage& operator=(const ScopedStage&) = delete;
+
+    private:
+      bool        active;
+      double      cpu_start;
+      StageRecord record;
+  };
+
+  std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+      switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n";  break;
+        case '\t': out += "\\t";  break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20) {
+            char buffer[8];
+            std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            out += buffer;
+          } else {out += c;}
+      }
+    }
+    return out + "\"";
+  }
+
+  // records are appended when a stage closes, so nested stages come before
+  // their parents; the summary restores start order within each chip.
+  std::vector<std::string> chip_order() {
+    std::vector<std::string> chips;
+    for (const auto& r : records) {
+      if (std::find(chips.begin(), chips.end(), r.chip) == chips.end()) {chips.push_back(r.chip);}
+    }
+    return chips;
+  }
+
+  void write_summary(const std::string& path) {
+    std::lock_guard<std::mutex> lock(records_mutex);
+    std::ofstream out(path);
+    if (!out.is_open()) {
+      std::cerr << "Error: unable to write profile '" << path << "'." << std::endl;
+      return;
+    }
+    std::vector<std::string> chips = chip_order();
+    out << "{\n  \"chips\": [";
+    for (std::size_t c = 0; c < chips.size(); ++c) {
+      std::vector<StageRecord> stages;
+      for (const auto& r : records) {if (r.chip == chips[c]) {stages.push_back(r);}}
+      std::stable_sort(stages.begin(), stages.end(),
+        [](const StageRecord& a, const StageRecord& b) {return a.start_us < b.start_us;});
+      long   chip_rss  = 0;
+      double chip_wall = 0;
+      for (const auto& r : stages) {
+        chip_rss = std::max(chip_rss, r.process_peak_rss_kb);
+        if (r.depth == 0) {chip_wall += r.wall_ms;}
+      }
+      out << (c ? "," : "") << "\n    {\n"
+        << "      \"chip\": " << json_string(chips[c]) << ",\n"
+        << "      \"wall_ms\": " << chip_wall << ",\n"
+        << "      \"process_peak_rss_kb\": " << chip_rss << ",\n"
+        << "      \"stages\": [";
+      for (std::size_t s = 0; s < stages.size(); ++s) {
+        const StageRecord& r = stages[s];
+        out << (s ? "," : "") << "\n        {"
+          << "\"stage\": " << json_string(r.stage) << ", "
+          << "\"depth\": " << r.depth << ", "
+          << "\"wall_ms\": " << r.wall_ms << ", "
+          << "\"cpu_ms\": " << r.cpu_ms << ", "
+          << "\"bytes_read\": " << r.bytes_read << ", "
+          << "\"rows_parsed\": " << r.rows_parsed << ", "
+          << "\"allocations\": " << r.allocations << ", "
+          << "\"bytes_allocated\": " << r.bytes_allocated << ", "
+          << "\"process_peak_rss_kb\": " << r.process_peak_rss_kb << "}";
+      }
+      out << "\n      ]\n    }";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+  // Chrome trace-event format, viewable in chrome://tracing or Perfetto.
+  void write_trace(const std::string& path) {
+    std::lock_guard<std::mutex> lock(records_mutex);
+    std::ofstream out(path);
+    if (!out.is_open()) {
+      std::cerr << "Error: unable to write trace '" << path << "'." << std::endl;
+      return;
+    }
+    out << "{\"traceEvents\": [";
+    for (std::size_t i = 0; i < records.size(); ++i) {
+      const StageRecord& r = records[i];
+      out << (i ? "," : "") << "\n  {"
+        << "\"name\": " << json_string(r.stage) << ", "
+        << "\"cat\": " << json_string(r.chip) << ", "
+        << "\"ph\": \"X\", "
+        << "\"ts\": " << static_cast<long long>(r.start_us) << ", "
+        << "\"dur\": " << static_cast<long long>(r.wall_ms * 1000.0) << ", "
+        << "\"pid\": 1, "
+        << "\"tid\": " << (r.thread % 100000) << ", "
+        << "\"args\": {"
+          << "\"chip\": " << json_string(r.chip) << ", "
+          << "\"cpu_ms\": " << r.cpu_ms << ", "
+          << "\"bytes_read\": " << r.bytes_read << ", "
+          << "\"rows_parsed\": " << r.rows_parsed << ", "
+          << "\"allocations\": " << r.allocations << ", "
+          << "\"process_peak_rss_kb\": " << r.process_peak_rss_kb << "}}";
+    }
+    out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+  }
+}
+
+// Replacement global allocation functions feeding the allocation counters,
+// only in builds with SCA_COUNT_ALLOCS (make COUNT_ALLOCS=1); otherwise the
+// allocation figures in a profile stay 0. Each program in this repo is a
+// single translation unit, so these are defined here rather than in a
+// separate source file. Until profiling is enabled the only cost over plain
+// malloc is one relaxed atomic load.
+#ifdef SCA_COUNT_ALLOCS
+void* operator new(std::size_t size) {
+  if (SmartchipProfile::counting_allocations.load(std::memory_order_relaxed)) {
+    ++SmartchipProfile::allocations;
+    SmartchipProfile::bytes_allocated += size;
+  }
+  if (void* ptr = std::malloc(size ? size : 1)) {return ptr;}
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) {return ::operator new(size);}
+// once inlined, GCC sees free() given a pointer from operator new, which is
+// the malloc above
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic push
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void  operator delete(void* ptr) noexcept {std::free(ptr);}
+void  operator delete[](void* ptr) noexcept {std::free(ptr);}
+void  operator delete(void* ptr, std::size_t) noexcept {std::free(ptr);}
+void  operator delete[](void* ptr, std::size_t) noexcept {std::free(ptr);}
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic pop
+#endif
+#endif // SCA_COUNT_ALLOCS
+
+#endif // PROFILE
@@ -0,0 +1,232 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: configurable QC thresholds compiled to per-row predicate columns
+ *
+ */
+
+#ifndef QC_RULES
+#define QC_RULES
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#include "defs_sds.hpp"
+#include "compress_sds.hpp"
+
+// A rules file has one rule per line, "metric op value [assay ...]":
+//
+//   # NTC must come up at least 3 cycles after STD1
+//   NTC_diff        >= 3
+//   NEG_Ct          >= 35
+//   NEG_Ct          >= 30   16S ITS
+//   positive_Ct     <= 33
+//
+// A rule without assays replaces the built-in rules for that metric; one
+// listing assays replaces them for those assays only. Rules on the same
+// metric and scope are combined with AND. The built-in rules reproduce the
+// fixed checks (NTC 3 cycles, NEG 35, positive Ct 33) and the efficiency
+// and r-squared command line thresholds.
+//
+// Rules are compiled once per chip into one threshold column per predicate,
+// aligned with the assay (or group) rows, and a verdict column is then
+// updated predicate by predicate over all rows.
+namespace SmartchipRules {
+  enum class comparison {lt, le, gt, ge};
+
+  enum class scope {assay, group, cutoff};
+
+  struct metric {
+    std::string name;
+    scope       level;
+    std::string verdict;
+    bool        nan_passes;
+  };
+
+  // missing control values have nothing to fail on; a missing efficiency
+  // or fit does
+  const std::vector<metric>& metrics() {
+    static const std::vector<metric> table = {
+      {"NTC_diff",          scope::assay,  "QC_NTC",      true},
+      {"NEG_Ct",            scope::assay,  "QC_NEG",      true},
+      {"STD_efficiency",    scope::assay,  "QC_StdCurve", false},
+      {"Rsqr",              scope::assay,  "QC_StdCurve", false},
+      {"sample_efficiency", scope::group,  "QCSample",    false},
+      {"positive_Ct",       scope::cutoff, "",            false},
+    };
+    return table;
+  }
+
+  int metric_index(const std::string& name) {
+    for (std::size_t m = 0; m < metrics().size(); ++m) {
+      if (metrics()[m].name == name) {return static_cast<int>(m);}
+    }
+    return -1;
+  }
+
+  comparison parse_comparison(const std::string& op) {
+    if (op == "<")  {return comparison::lt;}
+    if (op == "<=") {return comparison::le;}
+    if (op == ">")  {return comparison::gt;}
+    if (op == ">=") {return comparison::ge;}
+    throw std::invalid_argument("unknown comparison '" + op + "' (use <, <=, > or >=).");
+  }
+
+  bool compare(double value, comparison op, double threshold) {
+    switch (op) {
+      case comparison::lt: return value <  threshold;
+      case comparison::le: return value <= threshold;
+      case comparison::gt: return value >  threshold;
+      default:             return value >= threshold;
+    }
+  }
+
+  struct rule {
+    int         metric;
+    comparison  op;
+    double      value;
+    vstring     assays;
+  };
+
+  struct predicate {
+    int         metric;
+    comparison  op;
+    // per row; NaN where the predicate does not apply
+    vdouble     thresholds;
+  };
+
+  class rule_set {
+    public:
+      std::vector<rule> rules;
+
+      void load(const std::string& path) {
+        std::unique_ptr<std::istream> rules_stream = SdsCompress::open_input(path);
+        std::istream& rules_file = *rules_stream;
+        if (!rules_file) {throw std::invalid_argument("QC rules file '" + path + "' not found.");}
+        std::string line;
+        int line_number = 0;
+        while (std::getline(rules_file, line)) {
+          ++line_number;
+          line = line.substr(0, line.find('#'));
+          std::istringstream fields(line);
+          std::string name, op, value;
+          if (!(fields >> name)) {continue;}
+          auto where = [&]() {return "'" + path + "' line " + std::to_string(line_number) + ": ";};
+          if (!(fields >> op >> value)) {
+            throw std::invalid_argument(where() + "expected 'metric op value [assay ...]'.");
+          }
+          rule parsed;
+          parsed.metric = metric_index(name);
+          if (parsed.metric < 0) {throw std::invalid_argument(where() + "unknown metric '" + name + "'.");}
+          try {
+            parsed.op    = parse_comparison(op);
+            parsed.value = std::stod(value);
+          }
+          catch (const std::exception&) {
+            throw std::invalid_argument(where() + "invalid rule '" + line + "'.");
+          }
+          if (metrics()[parsed.metric].level == scope::cutoff
+            && parsed.op != comparison::le && parsed.op != comparison::lt) {
+            throw std::invalid_argument(where() + "'" + name + "' takes < or <=.");
+          }
+          std::string assay;
+          while (fields >> assay) {parsed.assays.push_back(assay);}
+          rules.push_back(parsed);
+        }
+      }
+
+      // `defaults` are used for a metric unless this set has a rule for it;
+      // one predicate per rule, with thresholds for each row's assay
+      std::vector<predicate> compile(scope level, const vstring& row_assays, const std::vector<rule>& defaults) const {
+        std::vector<predicate> compiled;
+        for (std::size_t m = 0; m < metrics().size(); ++m) {
+          if (metrics()[m].level != level) {continue;}
+          std::vector<const rule*> global, specific;
+          for (const auto& r : rules) {
+            if (r.metric != static_cast<int>(m)) {continue;}
+            (r.assays.empty() ? global : specific).push_back(&r);
+          }
+          if (global.empty()) {
+            for (const auto& r : defaults) {
+              if (r.metric == static_cast<int>(m)) {global.push_back(&r);}
+            }
+          }
+          std::unordered_map<std::string, bool> overridden;
+          for (const rule* r : specific) {
+            for (const auto& assay : r->assays) {overridden[assay] = true;}
+          }
+          auto add = [&](const rule* r, bool is_global) {
+            predicate p{r->metric, r->op, vdouble(row_assays.size(), std::numeric_limits<double>::quiet_NaN())};
+            for (std::size_t row = 0; row < row_assays.size(); ++row) {
+              const std::string& assay = row_assays[row];
+              bool applies = is_global ? !overridden.count(assay)
+                : std::find(r->assays.begin(), r->assays.end(), assay) != r->assays.end();
+              if (applies) {p.thresholds[row] = r->value;}
+            }
+            compiled.push_back(std::move(p));
+          };
+          for (const rule* r : global)   {add(r, true);}
+          for (const rule* r : specific) {add(r, false);}
+        }
+        return compiled;
+      }
+
+      // whether the defaults still decide `metric` for `assay`, i.e. no rule
+      // here replaces them
+      bool uses_default(int metric, const std::string& assay) const {
+        for (const auto& r : rules) {
+          if (r.metric != metric) {continue;}
+          if (r.assays.empty() || std::find(r.assays.begin(), r.assays.end(), assay) != r.assays.end()) {
+            return false;
+          }
+        }
+        return true;
+      }
+  };
+
+  // PASS/FAIL per row: each predicate is applied to its metric's column in
+  // turn, so the verdicts are one linear pass per predicate.
+  std::unordered_map<std::string, std::vector<char> > evaluate(
+    const std::vector<predicate>&                   predicates,
+    const std::unordered_map<int, const vdouble*>&  columns,
+    std::size_t                                     rows
+  ) {
+    std::unordered_map<std::string, std::vector<char> > verdicts;
+    for (const auto& p : predicates) {
+      const metric& m = metrics()[p.metric];
+      std::vector<char>& pass = verdicts.emplace(m.verdict, std::vector<char>(rows, 1)).first->second;
+      const vdouble& values = *columns.at(p.metric);
+      for (std::size_t row = 0; row < rows; ++row) {
+        const double threshold = p.thresholds[row];
+        if (std::isnan(threshold)) {continue;}
+        const double value = values[row];
+        pass[row] &= std::isnan(value) ? m.nan_passes : compare(value, p.op, threshold);
+      }
+    }
+    return verdicts;
+  }
+
+  // share of `values` meeting every cutoff predicate for this row, counted
+  // over all values (NaN included) as um_percent_below_threshold does
+  double fraction_passing(const vdouble& values, const std::vector<predicate>& cutoffs, std::size_t row) {
+    if (values.empty()) {return std::numeric_limits<double>::quiet_NaN();}
+    double passing = 0;
+    for (double value : values) {
+      bool pass = true;
+      for (const auto& p : cutoffs) {
+        if (!std::isnan(p.thresholds[row])) {pass = pass && compare(value, p.op, p.thresholds[row]);}
+      }
+      passing += pass;
+    }
+    return passing / values.size();
+  }
+}
+
+#endif // QC_RULES
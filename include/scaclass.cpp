@@ -21,83 +21,122 @@
   #include <sys/stat.h>
 #endif
 #include <stdexcept>
+#include <memory>
 
 #include "defs_sds.hpp"
 #include "maths_sds.hpp"
 #include "maps_sds.hpp"
 #include "defs_sds.hpp"
 #include "outputs.hpp"
+#include "profile.hpp"
+#include "compress_sds.hpp"
+#include "qc_rules.hpp"
+#include "spatial.hpp"
+#include "melt.hpp"
+#include "flags.hpp"
+#include "outliers.hpp"
+#include "standards.hpp"
 
 namespace SmartchipInfra {
   void file_check(const std::string& file) {
     if (!file.empty()) {
-      std::ifstream check(file);
-      if (!check.is_open()) {
+      #ifdef _WIN32
+        std::ifstream check(file);
+        bool found = check.is_open();
+      #else
+        struct stat info;
+        bool found = stat(file.c_str(), &info) == 0;
+      #endif
+      if (!found) {
         throw std::invalid_argument("Error: file '" + file + "' not found.");
       }
     }
   }
 
+  // modification time in seconds, or -1 when `path` is missing
+  double modified_time(const std::string& path) {
+    #ifdef _WIN32
+      return -1;
+    #else
+      struct stat info;
+      if (stat(path.c_str(), &info) != 0) {return -1;}
+      #ifdef __APPLE__
+        return info.st_mtimespec.tv_sec + info.st_mtimespec.tv_nsec * 1e-9;
+      #else
+        return info.st_mtim.tv_sec + info.st_mtim.tv_nsec * 1e-9;
+      #endif
+    #endif
+  }
+
+  // the assay QC, LIMS and full reports for `output_file` all exist and are
+  // no older than `newest_input`
+  bool reports_up_to_date(const std::string& output_file, double newest_input) {
+    const std::string ext = SdsCompress::extension(SdsCompress::output_format);
+    for (const char* report : {"_assay_QC_report.csv", "_LIMS_report.csv",
+      "_sample_qpcr_output_with_assay_info_qc.csv"}) {
+      double written = modified_time(output_file + report + ext);
+      if (written < 0 || written < newest_input) {return false;}
+    }
+    return true;
+  }
+
   std::string basename(const std::string& filepath) {
     std::string basename;
-    basename = filepath.substr(filepath.find_last_of("/\\") + 1);
+    basename = SdsCompress::strip_extension(filepath);
+    basename = basename.substr(basename.find_last_of("/\\") + 1);
     basename = basename.substr(0, basename.find_last_of("."));
     return(basename);
   }
 
-  std::vector<std::string> create_file_array(const std::string& path) {
-    std::vector<std::string> files;
-    DIR* directory = opendir(path.c_str());
-    if (directory != nullptr) {
-      dirent* entry;
-      while ((entry = readdir(directory)) != nullptr) {
-        if (entry->d_type == DT_REG) {
-          files.push_back(path + '/' + entry->d_name);
-        }
-      }
-      closedir(directory);
-    } else {
-      files.push_back(path);
+  bool contained_in_vector(const std::vector<std::string>& vector, const std::string& string) {
+    if (std::find(vector.begin(), vector.end(), string) == vector.end()) {
+      return false;
     }
-    return(files);
+    return true;
   }
 
-  std::vector<std::string> read_csv_headers(const std::string& file_name) {
-    std::string csv_file_name = file_name;
-    std::ifstream csv_file(csv_file_name);
-    if (!csv_file.is_open()) {
-      std::cerr << "Failed to open the CSV file." << std::endl;
+  std::string missing_fields_message(const std::string& csv, const std::vector<std::string>& missing) {
+    std::string message = "'" + csv + "' missing required field" + (missing.size() > 1 ? "s " : " ");
+    for (std::size_t i = 0; i < missing.size(); ++i) {
+      message += (i ? ", '" : "'") + missing[i] + "'";
     }
-    std::string header_line;
-    std::vector<std::string> columns;
-    std::string column;
-    if (std::getline(csv_file, header_line)) {
-      std::istringstream header_stream(header_line);
-      while (std::getline(header_stream, column, ',')) {
-        columns.push_back(column);
-      }
-    } else {
-      std::cerr << "Failed to read the header line from the CSV file." << std::endl;
-    }
-    csv_file.close();
-    return(columns);
+    return message + ".";
   }
 
-  bool contained_in_vector(const std::vector<std::string>& vector, const std::string& string) {
-    if (std::find(vector.begin(), vector.end(), string) == vector.end()) {
-      return false;
+  // Column indices for `names` in an already parsed header; every missing
+  // name is reported in a single error.
+  std::vector<int> resolve_columns(
+    const std::unordered_map<std::string, int>& colnames,
+    const std::vector<std::string>&             names,
+    const std::string&                          csv
+  ) {
+    std::vector<int> indices;
+    std::vector<std::string> missing;
+    for (const std::string& name : names) {
+      auto col = colnames.find(name);
+      if (col == colnames.end()) {
+        missing.push_back(name);
+      } else {indices.push_back(col->second);}
     }
-    return true;
+    if (!missing.empty()) {
+      throw std::invalid_argument(missing_fields_message(csv, missing));
+    }
+    return indices;
   }
 
-  void check_headers(const std::string& csv, const std::vector<std::string>& required_headers) {
-    std::vector<std::string> file_headers;
-    file_headers = SmartchipInfra::read_csv_headers(csv);
-    for (const std::string& header : required_headers) {
-      if (!SmartchipInfra::contained_in_vector(file_headers, header)) {
-        throw std::invalid_argument("'" + csv + "' missing required field '" + header + "'.");
-      }
+  // report prefix for results combined over every chip in `input`; follows
+  // the same directory-or-prefix rule as SmartchipIngest::set_output_dir.
+  std::string batch_prefix(std::string input, const std::string& output) {
+    while (input.size() > 1 && (input.back() == '/' || input.back() == '\\')) {input.pop_back();}
+    std::string name = input.substr(input.find_last_of("/\\") + 1);
+    if (output.empty()) {return input + "/sca_output/" + name;}
+    DIR* directory = opendir(output.c_str());
+    if (directory != nullptr) {
+      closedir(directory);
+    } else if (output.back() != '/' && output.back() != '\\') {
+      return output;
     }
+    return output + (output.back() == '/' || output.back() == '\\' ? "" : "/") + name;
   }
 
   void make_dir(const std::string& directoryPath) {
@@ -129,6 +168,10 @@ class SmartchipIngest {
     std::string output_file;
     std::string replacement_stds_path;
     std::string gene_magnitudes_path;
+    std::string chip_name;
+    um_str_flo  gene_magnitudes;
+    // replacement standards parsed once and shared by every chip using them
+    std::shared_ptr<const csv_table> replacement_table;
     
     SmartchipIngest(
       const std::string&  qPCR_data_path
@@ -141,20 +184,31 @@ class SmartchipIngest {
     void set_input(const std::string&);
     void set_replacement_stds(const std::string&);
     void set_gene_magnitudes(const std::string&);
-  
-  protected:
-    um_str_flo  gene_magnitudes;
 };
 
 void SmartchipIngest::construct_ingest() {
   set_input(input_path);
   output_dir = input_path.substr(0, input_path.find_last_of("/\\"));
   output_dir += "/sca_output/";
-  output_file = output_dir;
-  output_file += SmartchipInfra::basename(input_path);
+  chip_name = SmartchipInfra::basename(input_path);
+  output_file = output_dir + chip_name;
 }
 
-void SmartchipIngest::set_output_dir(const std::string& path) {output_dir = path;}
+// a directory keeps the input basename for the reports; anything else is
+// taken as a path prefix for the report files.
+void SmartchipIngest::set_output_dir(const std::string& path) {
+  DIR* directory = opendir(path.c_str());
+  if (directory != nullptr || path.back() == '/' || path.back() == '\\') {
+    if (directory != nullptr) {closedir(directory);}
+    output_dir = path;
+    if (output_dir.back() != '/' && output_dir.back() != '\\') {output_dir += '/';}
+    output_file = output_dir + chip_name;
+  } else {
+    std::size_t sep = path.find_last_of("/\\");
+    output_dir = sep == std::string::npos ? "./" : path.substr(0, sep + 1);
+    output_file = path;
+  }
+}
 void SmartchipIngest::set_input(const std::string& qPCR_data_path) {
   input_path = qPCR_data_path;
   try {
@@ -192,6 +246,17 @@ void SmartchipIngest::set_gene_magnitudes(const std::string& path) {
 
 class SmartchipParameters : public SmartchipIngest {
   public:
+    struct column_indices {
+      int assay       = -1;
+      int sample      = -1;
+      int ct          = -1;
+      int efficiency  = -1;
+      int row         = -1;
+      int column      = -1;
+      int tm          = -1;
+      int flags       = -1;
+    };
+
     std::string assay_colname;
     std::string sample_colname;
     std::string ct_colname;
@@ -199,9 +264,25 @@ class SmartchipParameters : public SmartchipIngest {
     std::string standard_id;
     std::string non_template_id;
     std::string efficiency_colname;
+    std::string row_colname;
+    std::string column_colname;
+    std::string tm_colname;
+    std::string flags_colname;
     float       efficiency_min;
     float       efficiency_max;
     float       r_sqared_threshold;
+    robust_weight robust_method;
+    bool        estimate_limits;
+    float       detection_ct;
+    SmartchipRules::rule_set qc_rules;
+    bool        spatial;
+    bool        melt;
+    float       melt_tolerance;
+    std::uint32_t exclude_flags;
+    SmartchipOutliers::method outlier_test;
+    float       outlier_alpha;
+    bool        audit;
+    SmartchipStandards::definition standards;
 
     SmartchipParameters(
       const std::string& qPCR_data_path
@@ -209,8 +290,10 @@ class SmartchipParameters : public SmartchipIngest {
       construct_params();
     }
     SmartchipParameters(
-      const SmartchipIngest ingest
-    ) : SmartchipParameters(ingest.input_path) {}
+      SmartchipIngest ingest
+    ) : SmartchipIngest(std::move(ingest)) {
+      construct_params();
+    }
 
     // void check_Smartchip_headers();
 
@@ -222,9 +305,27 @@ class SmartchipParameters : public SmartchipIngest {
     void set_standard_id(const std::string&);
     void set_non_template_control(const std::string&);
     void set_efficiency_colname(const std::string&);
+    void set_row_colname(const std::string&);
+    void set_column_colname(const std::string&);
+    void set_tm_colname(const std::string&);
+    void set_flags_colname(const std::string&);
     void set_efficiency_min(const float&);
     void set_efficiency_max(const float&);
     void set_r_sqared_threshold(const float&);
+    void set_robust_method(const robust_weight&);
+    void set_estimate_limits(const bool&);
+    void set_detection_ct(const float&);
+    void set_qc_rules(const SmartchipRules::rule_set&);
+    void set_spatial(const bool&);
+    void set_melt(const bool&);
+    void set_melt_tolerance(const float&);
+    void set_exclude_flags(const std::uint32_t&);
+    void set_outlier_test(const SmartchipOutliers::method&);
+    void set_outlier_alpha(const float&);
+    void set_audit(const bool&);
+    void set_standards(const SmartchipStandards::definition&);
+    std::vector<SmartchipRules::rule> default_rules() const;
+    column_indices resolve_columns(const csv_table&, const std::string&, bool = true) const;
 };
 
 void SmartchipParameters::construct_params() {
@@ -234,31 +335,508 @@ void SmartchipParameters::construct_params() {
   negative_control_id   = "NEG";
   standard_id           = "STD";
   non_template_id       = "NTC";
-  non_template_id       = "Efficiency";
+  efficiency_colname    = "Efficiency";
+  row_colname           = "Row";
+  column_colname        = "Column";
+  tm_colname            = "Tm";
+  flags_colname         = "Flags";
   efficiency_min        = 1.70;
   efficiency_max        = 2.20;
   r_sqared_threshold    = 0.85;
+  robust_method         = robust_weight::none;
+  estimate_limits       = false;
+  detection_ct          = 35;
+  spatial               = false;
+  melt                  = false;
+  melt_tolerance        = 1.5;
+  exclude_flags         = 0;
+  outlier_test          = SmartchipOutliers::method::none;
+  outlier_alpha         = 0.05;
+  audit                 = false;
 }
 
-void SmartchipParameters::set_assay_colname(const std::string& x)         {assay_colname = x; SmartchipInfra::check_headers(data, {x});}
-void SmartchipParameters::set_sample_colname(const std::string& x)        {sample_colname = x; SmartchipInfra::check_headers(data, {x});}
-void SmartchipParameters::set_qPCR_ct_colname(const std::string& x)       {ct_colname = x; SmartchipInfra::check_headers(data, {x});}
-void SmartchipParameters::set_efficiency_colname(const std::string& x)    {efficiency_colname = x; SmartchipInfra::check_headers(data, {x});}
+void SmartchipParameters::set_assay_colname(const std::string& x)         {assay_colname = x;}
+void SmartchipParameters::set_sample_colname(const std::string& x)        {sample_colname = x;}
+void SmartchipParameters::set_qPCR_ct_colname(const std::string& x)       {ct_colname = x;}
+void SmartchipParameters::set_efficiency_colname(const std::string& x)    {efficiency_colname = x;}
+void SmartchipParameters::set_row_colname(const std::string& x)           {row_colname = x;}
+void SmartchipParameters::set_column_colname(const std::string& x)        {column_colname = x;}
+void SmartchipParameters::set_tm_colname(const std::string& x)            {tm_colname = x;}
+void SmartchipParameters::set_flags_colname(const std::string& x)         {flags_colname = x;}
 void SmartchipParameters::set_negative_control(const std::string& x)      {negative_control_id = x;}
 void SmartchipParameters::set_standard_id(const std::string& x)           {standard_id = x;}
 void SmartchipParameters::set_non_template_control(const std::string& x)  {non_template_id = x;}
 void SmartchipParameters::set_efficiency_min(const float& x)              {efficiency_min = x;}
 void SmartchipParameters::set_efficiency_max(const float& x)              {efficiency_max = x;}
 void SmartchipParameters::set_r_sqared_threshold(const float& x)          {r_sqared_threshold = x;}
+void SmartchipParameters::set_robust_method(const robust_weight& x)       {robust_method = x;}
+void SmartchipParameters::set_estimate_limits(const bool& x)              {estimate_limits = x;}
+void SmartchipParameters::set_detection_ct(const float& x)                {detection_ct = x;}
+void SmartchipParameters::set_qc_rules(const SmartchipRules::rule_set& x) {qc_rules = x;}
+void SmartchipParameters::set_spatial(const bool& x)                      {spatial = x;}
+void SmartchipParameters::set_melt(const bool& x)                         {melt = x;}
+void SmartchipParameters::set_melt_tolerance(const float& x)              {melt_tolerance = x;}
+void SmartchipParameters::set_exclude_flags(const std::uint32_t& x)       {exclude_flags = x;}
+void SmartchipParameters::set_outlier_test(const SmartchipOutliers::method& x) {outlier_test = x;}
+void SmartchipParameters::set_outlier_alpha(const float& x)               {outlier_alpha = x;}
+void SmartchipParameters::set_audit(const bool& x)                        {audit = x;}
+void SmartchipParameters::set_standards(const SmartchipStandards::definition& x) {standards = x;}
+
+// the fixed checks and command line thresholds, used for any metric the
+// rules file leaves alone
+std::vector<SmartchipRules::rule> SmartchipParameters::default_rules() const {
+  using SmartchipRules::comparison;
+  auto metric = SmartchipRules::metric_index;
+  return {
+    {metric("NTC_diff"),          comparison::ge, 3,                  {}},
+    {metric("NEG_Ct"),            comparison::ge, 35,                 {}},
+    {metric("STD_efficiency"),    comparison::ge, efficiency_min,     {}},
+    {metric("STD_efficiency"),    comparison::le, efficiency_max,     {}},
+    {metric("Rsqr"),              comparison::ge, r_sqared_threshold, {}},
+    {metric("sample_efficiency"), comparison::ge, efficiency_min,     {}},
+    {metric("positive_Ct"),       comparison::le, 33,                 {}},
+  };
+}
+
+// Column names are only checked here, against the header the ingest has
+// already parsed, so the input is not reopened per setter.
+SmartchipParameters::column_indices SmartchipParameters::resolve_columns(
+  const csv_table&    table,
+  const std::string&  source,
+  bool                need_efficiency
+) const {
+  vstring names = {assay_colname, sample_colname, ct_colname};
+  if (need_efficiency) {names.push_back(efficiency_colname);}
+  // well positions, Tm and flags only for the chip itself, and only when used
+  bool need_position = need_efficiency && spatial;
+  bool need_tm       = need_efficiency && melt;
+  bool need_flags    = need_efficiency && exclude_flags;
+  if (need_position) {
+    names.push_back(row_colname);
+    names.push_back(column_colname);
+  }
+  if (need_tm) {names.push_back(tm_colname);}
+  if (need_flags) {names.push_back(flags_colname);}
+  std::vector<int> indices = SmartchipInfra::resolve_columns(table.colnames, names, source);
+  column_indices columns;
+  std::size_t next = 0;
+  columns.assay       = indices[next++];
+  columns.sample      = indices[next++];
+  columns.ct          = indices[next++];
+  if (need_efficiency) {columns.efficiency = indices[next++];}
+  if (need_position) {
+    columns.row       = indices[next++];
+    columns.column    = indices[next++];
+  }
+  if (need_tm) {columns.tm = indices[next++];}
+  if (need_flags) {columns.flags = indices[next++];}
+  return columns;
+}
+
+//
+// Stage results
+//
+
+// Each stage's output owns its data and can only be moved, so it is handed
+// to the next stage rather than recomputed from input_path. A later stage
+// only reads an earlier result, which lets it be re-run (e.g. transform with
+// new thresholds) without re-reading or re-parsing the chip.
+struct move_only {
+  move_only() = default;
+  move_only(move_only&&) = default;
+  move_only& operator=(move_only&&) = default;
+  move_only(const move_only&) = delete;
+  move_only& operator=(const move_only&) = delete;
+};
+
+struct IngestResult : move_only {
+  csv_table                           table;
+  SmartchipParameters::column_indices columns;
+  std::shared_ptr<const csv_table>    replacement;
+  SmartchipParameters::column_indices replacement_columns;
+  // spatial only: table row behind each well of the 72 x 72 chip
+  SmartchipSpatial::well_grid         plate;
+  // exclude_flags only: instrument flags of each table row
+  std::vector<std::uint32_t>          flags;
+};
+
+struct ExtractResult : move_only {
+  vstring       assays;
+  vstring       groups;
+  um_str_vstr   assay_group;
+  um_str_str    group_assay;
+  um_str_vdbl   group_Ct;
+  um_str_dbl    Ct_means;
+  um_str_vdbl   array_Ct;
+  um_str_dbl    Ct_perc_below;
+  um_str_dbl    Ct_sd;
+  um_str_str    group_sample;
+  um_str_dbl    group_efficiency;
+  um_str_vstr   replacement_assay_group;
+  um_str_vdbl   replacement_group_Ct;
+  // log10 concentration of each standard group, chip and replacement
+  um_str_dbl    group_log_abundance;
+  um_str_dbl    replacement_group_log_abundance;
+  // replicates rejected by the outlier test, now NaN in group_Ct
+  std::vector<SmartchipOutliers::rejected_well> rejected;
+  // spatial only: lane trends and the wells left out of copy numbers
+  SmartchipSpatial::plate_model spatial;
+  // melt only: reference Tm per assay, mean Tm and QC_Melt per group
+  SmartchipMelt::melt_calls     melt;
+};
+
+struct TransformResult : move_only {
+  um_str_dbl  NTC_means;
+  um_str_dbl  STD_means;
+  um_str_str  QC_NTC;
+  um_str_dbl  NEG_means;
+  um_str_str  QC_NEG;
+  um_str_str  std_QC;
+  um_str_dbl  rsqr_map;
+  um_str_dbl  std_efficiency_map;
+  um_str_pair_dbl_dbl regression_map;
+  um_str_str  group_QC;
+  um_str_vdbl group_copyN;
+  // fit of the chip's own standards that std_QC was judged on, kept even
+  // when replacement standards are fitted afterwards
+  um_str_dbl  chip_std_efficiency;
+  um_str_dbl  chip_rsqr_map;
+  // robust fits only: standard wells left with under half weight
+  std::unordered_map<std::string, std::vector<well_weight> > downweighted_wells;
+  // standard points behind regression_map, for resampling; robust fits
+  // also keep their final weights
+  um_str_vdbl curve_log_abundance;
+  um_str_vdbl curve_Ct;
+  um_str_vdbl curve_weight;
+  // estimate_limits only: per-assay LOD/LOQ and each group's QC_LOQ flag
+  std::unordered_map<std::string, SmartchipDetection::detection_limits> detection_limits;
+  um_str_str  group_LOQ;
+};
+
+namespace SmartchipStages {
+  void resolve_ingest(const SmartchipParameters& params, IngestResult& ingested) {
+    if (ingested.table.colnames.empty()) {
+      throw std::invalid_argument("'" + params.data + "' could not be read or has no header line.");
+    }
+    ingested.columns = params.resolve_columns(ingested.table, params.data);
+    if (params.exclude_flags) {
+      ingested.flags = SmartchipFlags::decode_column(ingested.table, ingested.columns.flags);
+    }
+    if (params.spatial) {
+      ingested.plate = SmartchipSpatial::build_grid(ingested.table, ingested.columns.row, ingested.columns.column, params.data);
+    }
+    if (!params.replacement_stds_path.empty()) {
+      ingested.replacement = params.replacement_table ? params.replacement_table
+        : std::make_shared<const csv_table>(read_csv(params.replacement_stds_path));
+      ingested.replacement_columns = params.resolve_columns(*ingested.replacement, params.replacement_stds_path, false);
+    }
+  }
+
+  IngestResult ingest(const SmartchipParameters& params) {
+    SmartchipProfile::ScopedStage stage(params.chip_name, "ingest");
+    IngestResult ingested;
+    ingested.table = read_csv(params.data);
+    resolve_ingest(params, ingested);
+    return ingested;
+  }
+
+  // rows already in memory (e.g. one chip of an archive); only the
+  // replacement standards, if any, are read from disk.
+  IngestResult ingest(const SmartchipParameters& params, csv_table table) {
+    SmartchipProfile::ScopedStage stage(params.chip_name, "ingest");
+    IngestResult ingested;
+    ingested.table = std::move(table);
+    resolve_ingest(params, ingested);
+    return ingested;
+  }
+
+  ExtractResult extract(const SmartchipParameters& params, const IngestResult& ingested) {
+    SmartchipProfile::ScopedStage stage(params.chip_name, "extract");
+    const csv_table& table = ingested.table;
+    const SmartchipParameters::column_indices& columns = ingested.columns;
+    ExtractResult extracted;
+    std::vector<int> id = {columns.assay, columns.sample};
+    extracted.assay_group       = map_variable_vec(table, {columns.assay}, id);
+    extracted.group_assay       = map_variable(table, id, columns.assay);
+    // wells with an excluded flag read as missing Ct and efficiency
+    const std::vector<std::uint32_t>& flags = ingested.flags;
+    const std::uint32_t exclude = params.exclude_flags;
+    extracted.group_Ct          = map_variable_vec_numeric(table, id, {columns.ct}, flags, exclude);
+    extracted.array_Ct          = map_variable_vec_numeric(table, {columns.assay}, {columns.ct}, flags, exclude);
+    extracted.group_sample      = map_variable(table, id, columns.sample);
+    extracted.group_efficiency  = um_mean(map_variable_vec_numeric(table, id, {columns.efficiency}, flags, exclude));
+    if (!params.replacement_stds_path.empty()) {
+      const SmartchipParameters::column_indices& replacement = ingested.replacement_columns;
+      std::vector<int> replacement_id = {replacement.assay, replacement.sample};
+      extracted.replacement_assay_group = map_variable_vec(*ingested.replacement, {replacement.assay}, replacement_id);
+      extracted.replacement_group_Ct    = map_variable_vec_numeric(*ingested.replacement, replacement_id, {replacement.ct});
+      extracted.replacement_group_log_abundance = SmartchipStandards::resolve(params.standards,
+        extracted.replacement_assay_group, map_variable(*ingested.replacement, replacement_id, replacement.sample),
+        params.standard_id, params.replacement_stds_path);
+    }
+    extracted.group_log_abundance = SmartchipStandards::resolve(params.standards, extracted.assay_group,
+      extracted.group_sample, params.standard_id, params.data);
+    for (auto const& it : extracted.assay_group) {extracted.assays.push_back(it.first);}
+    natural_sort(extracted.assays);
+    for (auto const& it : extracted.group_assay) {extracted.groups.push_back(it.first);}
+    natural_sort(extracted.groups);
+    // one pass per group: outlier test, then mean and sd of what is kept
+    SmartchipOutliers::tester outliers(params.outlier_test, params.outlier_alpha);
+    for (auto const& group : extracted.groups) {
+      outliers.run(group, extracted.group_Ct[group], extracted.Ct_means[group], extracted.Ct_sd[group],
+        extracted.rejected);
+    }
+    std::vector<SmartchipRules::predicate> cutoffs = params.qc_rules.compile(
+      SmartchipRules::scope::cutoff, extracted.assays, params.default_rules());
+    for (std::size_t a = 0; a < extracted.assays.size(); ++a) {
+      const std::string& assay = extracted.assays[a];
+      extracted.Ct_perc_below[assay] = SmartchipRules::fraction_passing(um_at(extracted.array_Ct, assay), cutoffs, a);
+    }
+    return extracted;
+  }
+
+  // row, column, nozzle and edge trends over the chip's well positions
+  SmartchipSpatial::plate_model spatial(const SmartchipParameters& params, const IngestResult& ingested) {
+    SmartchipProfile::ScopedStage stage(params.chip_name, "spatial");
+    const SmartchipParameters::column_indices& columns = ingested.columns;
+    return SmartchipSpatial::analyze(ingested.table, ingested.plate, columns.ct, columns.efficiency,
+      {columns.assay, columns.sample});
+  }
+
+  // Tm specificity against each assay's standards
+  SmartchipMelt::melt_calls melt(const SmartchipParameters& params, const IngestResult& ingested) {
+    SmartchipProfile::ScopedStage stage(params.chip_name, "melt");
+    const SmartchipParameters::column_indices& columns = ingested.columns;
+    return SmartchipMelt::analyze(SmartchipMelt::gather(ingested.table, columns.assay, columns.sample,
+      columns.ct, columns.tm, params.standard_id), params.melt_tolerance, params.detection_ct);
+  }
+
+  // QC, standard-curve regression and copy numbers for one chip; reads the
+  // extracted maps only, so the same ExtractResult can be transformed again
+  // under different parameters.
+  class TransformPass {
+    public:
+      TransformPass(
+        const SmartchipParameters&  params,
+        const ExtractResult&        extracted
+      ) : params(params), extracted(extracted) {}
+
+      TransformResult run();
+
+    private:
+      const SmartchipParameters&  params;
+      const ExtractResult&        extracted;
+      TransformResult             result;
+      robust_workspace            workspace;
+      std::vector<std::pair<const std::string*, int> > wells;
+
+      void transform_assays();
+      void transform_groups();
+      void control_means(const std::string&);
+      void quality_check_assays();
+      void quality_check_groups();
+      void extract_log_value_and_Ct(const um_str_vstr&, const um_str_dbl&, const std::string&, vdouble&, vdouble&);
+      void regression_analysis(const std::string&, const vdouble&, const vdouble&);
+      void calculate_copyN(const std::string&);
+      void estimate_limits(const std::string&, const vdouble&, const vdouble&);
+      float gene_coefficient(const std::string&) const;
+  };
+
+  TransformResult TransformPass::run() {
+    SmartchipProfile::ScopedStage stage(params.chip_name, "transform");
+    transform_assays();
+    transform_groups();
+    return std::move(result);
+  }
+
+  // Every assay is fitted on its own standards first, then all assay QC
+  // verdicts are evaluated together, and only the assays whose curve
+  // failed are refitted on the replacement standards.
+  void TransformPass::transform_assays() {
+    SmartchipProfile::ScopedStage stage(params.chip_name, "regression");
+    for (auto const& assay : extracted.assays) {
+      vdouble  log_abundances;
+      vdouble  Ct_values;
+      control_means(assay);
+      extract_log_value_and_Ct(extracted.assay_group, extracted.group_log_abundance, assay, log_abundances, Ct_values);
+      regression_analysis(assay, log_abundances, Ct_values);
+      result.chip_std_efficiency[assay] = result.std_efficiency_map[assay];
+      result.chip_rsqr_map[assay]       = result.rsqr_map[assay];
+      if (params.estimate_limits) {estimate_limits(assay, log_abundances, Ct_values);}
+    }
+    quality_check_assays();
+    for (auto const& assay : extracted.assays) {
+      if (result.std_QC[assay] == "FAIL") {
+        if (extracted.replacement_assay_group.find(assay) != extracted.replacement_assay_group.end()) {
+          vdouble  log_abundances;
+          vdouble  Ct_values;
+          extract_log_value_and_Ct(extracted.replacement_assay_group, extracted.replacement_group_log_abundance,
+            assay, log_abundances, Ct_values);
+          regression_analysis(assay, log_abundances, Ct_values);
+        }
+      }
+    }
+  }
+
+  void TransformPass::transform_groups() {
+    SmartchipProfile::ScopedStage stage(params.chip_name, "copy_number");
+    for (auto const& group : extracted.groups) {
+      calculate_copyN(group);
+      if (params.estimate_limits) {
+        const std::string& assay = um_at(extracted.group_assay, group);
+        result.group_LOQ[group] = SmartchipDetection::flag(mean(result.group_copyN[group]),
+          um_at(result.detection_limits, assay), gene_coefficient(assay));
+      }
+    }
+    quality_check_groups();
+  }
+
+  void TransformPass::control_means(const std::string& assay) {
+    const vstring& assay_groups = um_at(extracted.assay_group, assay);
+    result.NTC_means[assay] = um_at(extracted.Ct_means, search_vsrting(assay_groups, params.non_template_id));
+    result.STD_means[assay] = um_at(extracted.Ct_means, search_vsrting(assay_groups, params.standard_id + "1"));
+    if (params.negative_control_id == "none") {
+      result.NEG_means[assay] = std::numeric_limits<double>::quiet_NaN();
+    } else {
+      result.NEG_means[assay] = um_at(extracted.Ct_means, search_vsrting(assay_groups, params.negative_control_id));
+    }
+  }
+
+  // QC_NTC, QC_NEG and QC_StdCurve for every assay from the compiled rules,
+  // judged on each chip's own standard curve
+  void TransformPass::quality_check_assays() {
+    const vstring& assays = extracted.assays;
+    const std::size_t n = assays.size();
+    vdouble NTC_diff(n), NEG_Ct(n), efficiency(n), rsqr(n);
+    for (std::size_t a = 0; a < n; ++a) {
+      NTC_diff[a]   = result.NTC_means[assays[a]] - result.STD_means[assays[a]];
+      NEG_Ct[a]     = result.NEG_means[assays[a]];
+      efficiency[a] = result.chip_std_efficiency[assays[a]];
+      rsqr[a]       = result.chip_rsqr_map[assays[a]];
+    }
+    auto metric = SmartchipRules::metric_index;
+    std::unordered_map<int, const vdouble*> columns = {
+      {metric("NTC_diff"), &NTC_diff}, {metric("NEG_Ct"), &NEG_Ct},
+      {metric("STD_efficiency"), &efficiency}, {metric("Rsqr"), &rsqr}};
+    auto verdicts = SmartchipRules::evaluate(
+      params.qc_rules.compile(SmartchipRules::scope::assay, assays, params.default_rules()), columns, n);
+    for (std::size_t a = 0; a < n; ++a) {
+      result.QC_NTC[assays[a]] = verdicts["QC_NTC"][a] ? "PASS" : "FAIL";
+      result.QC_NEG[assays[a]] = params.negative_control_id == "none" ? "NONE"
+        : verdicts["QC_NEG"][a] ? "PASS" : "FAIL";
+      result.std_QC[assays[a]] = verdicts["QC_StdCurve"][a] ? "PASS" : "FAIL";
+    }
+  }
+
+  void TransformPass::quality_check_groups() {
+    const vstring& groups = extracted.groups;
+    vstring group_assays;
+    vdouble efficiency;
+    for (auto const& group : groups) {
+      group_assays.push_back(um_at(extracted.group_assay, group));
+      efficiency.push_back(um_at(extracted.group_efficiency, group));
+    }
+    std::unordered_map<int, const vdouble*> columns = {
+      {SmartchipRules::metric_index("sample_efficiency"), &efficiency}};
+    auto verdicts = SmartchipRules::evaluate(
+      params.qc_rules.compile(SmartchipRules::scope::group, group_assays, params.default_rules()),
+      columns, groups.size());
+    for (std::size_t g = 0; g < groups.size(); ++g) {
+      result.group_QC[groups[g]] = verdicts["QCSample"][g] ? "PASS" : "FAIL";
+    }
+  }
+
+  void TransformPass::extract_log_value_and_Ct(
+    const um_str_vstr& assay_group,
+    const um_str_dbl&  group_log_abundance,
+    const std::string& assay, 
+    vdouble& log_abundances, 
+    vdouble& Ct_values
+  ) {
+    wells.clear();
+    // the standards resolved for this chip; see SmartchipStandards::resolve
+    for (auto const& group : um_at(assay_group, assay)) {
+      auto resolved = group_log_abundance.find(group);
+      if (resolved != group_log_abundance.end()) {
+        const double log_abundance_value = resolved->second;
+        const vdouble& group_Cts = um_at(extracted.group_Ct, group);
+        Ct_values.insert(std::end(Ct_values), std::begin(group_Cts), std::end(group_Cts));
+        for (std::size_t i = 0; i < group_Cts.size(); i++) {
+          log_abundances.push_back(log_abundance_value);
+          wells.push_back({&group, static_cast<int>(i) + 1});
+        }
+      }
+    }
+  }
+
+  void TransformPass::regression_analysis(const std::string& assay, const vdouble& log_abundances, const vdouble& Ct_values) {
+    result.downweighted_wells.erase(assay);
+    result.curve_weight.erase(assay);
+    result.curve_log_abundance[assay] = log_abundances;
+    result.curve_Ct[assay]            = Ct_values;
+    if (std::none_of(Ct_values.begin(), Ct_values.end(), [](double ct) {return !std::isnan(ct);})) {
+      result.regression_map[assay]     = {0,0};
+      result.rsqr_map[assay]           = 0;
+      result.std_efficiency_map[assay] = 0;
+    } else if (params.robust_method != robust_weight::none) {
+      robust_fit fit = robust_lm(log_abundances, Ct_values, params.robust_method, workspace);
+      result.regression_map[assay]     = {fit.a, fit.b};
+      result.rsqr_map[assay]           = fit.rsqr;
+      result.std_efficiency_map[assay] = std::pow(10, -1/fit.b);
+      result.curve_weight[assay]       = workspace.weights;
+      for (std::size_t i = 0; i < wells.size(); ++i) {
+        if (std::isnan(Ct_values[i]) || workspace.weights[i] >= 0.5) {continue;}
+        result.downweighted_wells[assay].push_back(well_weight{*wells[i].first, wells[i].second,
+          log_abundances[i], Ct_values[i], workspace.weights[i]});
+      }
+    } else {
+      result.regression_map[assay]     = lm(log_abundances, Ct_values);
+      result.rsqr_map[assay]           = coef_determination(log_abundances, Ct_values);
+      result.std_efficiency_map[assay] = std::pow(10, -1/result.regression_map[assay].second);
+    }
+  }
+
+  // limits come from the chip's own dilution series and curve, with the
+  // assay's NTC and NEG wells as blanks
+  void TransformPass::estimate_limits(const std::string& assay, const vdouble& log_abundances, const vdouble& Ct_values) {
+    vdouble blank_Cts;
+    for (auto const& group : um_at(extracted.assay_group, assay)) {
+      bool blank = group.find(params.non_template_id) != std::string::npos
+        || (params.negative_control_id != "none" && group.find(params.negative_control_id) != std::string::npos);
+      if (!blank) {continue;}
+      const vdouble& Cts = um_at(extracted.group_Ct, group);
+      blank_Cts.insert(blank_Cts.end(), Cts.begin(), Cts.end());
+    }
+    result.detection_limits[assay] = SmartchipDetection::estimate(log_abundances, Ct_values,
+      result.regression_map[assay], blank_Cts, params.detection_ct);
+  }
+
+  float TransformPass::gene_coefficient(const std::string& assay) const {
+    auto magnitude = params.gene_magnitudes.find(assay);
+    return magnitude != params.gene_magnitudes.end() ? magnitude->second : 1;
+  }
 
-// void SmartchipParameters::check_Smartchip_headers() {
-//   try {
-//     SmartchipInfra::check_headers(data, {sample_colname, assay_colname, efficiency_colname, ct_colname});
-//   }
-//   catch (const std::exception& e) {
-//     std::cerr << "Error in input_files: " << e.what() << std::endl;
-//   }
-// }
+  void TransformPass::calculate_copyN(const std::string& group) {
+    const std::string& a = um_at(extracted.group_assay, group);
+    const std::pair<double, double>& fit = result.regression_map[a];
+    const vdouble& group_Cts = um_at(extracted.group_Ct, group);
+    vdouble copy_N;
+    for (auto Ct : group_Cts) {
+      double N = std::pow(10, (Ct - fit.first)/fit.second);
+      copy_N.push_back(N);
+    }
+    for (int replicate : um_at(extracted.spatial.excluded_replicates, group)) {
+      copy_N[replicate] = std::numeric_limits<double>::quiet_NaN();
+    }
+    // magnify drops the NaNs, so replicate positions end here
+    copy_N = magnify(copy_N, gene_coefficient(a));
+    result.group_copyN[group] = copy_N;
+  }
+
+  TransformResult transform(const SmartchipParameters& params, const ExtractResult& extracted) {
+    return TransformPass(params, extracted).run();
+  }
+}
 
 //
 // Class SmartchipExtract
@@ -272,70 +850,31 @@ class SmartchipExtract : public SmartchipParameters {
       construct_extract();
     }
     SmartchipExtract(
-      const SmartchipIngest ingest
-    ) : SmartchipExtract(ingest.input_path) {}
+      SmartchipParameters parameters
+    ) : SmartchipParameters(std::move(parameters)) {
+      construct_extract();
+    }
     SmartchipExtract(
-      const SmartchipParameters parameters
-    ) : SmartchipExtract(parameters.input_path) {}
-    
-    vstring       assays;
-  
-  // protected:
-    um_str_vstr   assay_group;
-    um_str_str    group_assay;
-    um_str_vdbl   group_Ct;
-    um_str_dbl    Ct_means;
-    um_str_vdbl   array_Ct;
-    um_str_dbl    Ct_perc_below;
-    um_str_dbl    Ct_sd;
-    um_str_str    group_sample;
-    um_str_dbl    group_efficiency;
-    um_str_vstr   replacement_assay_group;
-    um_str_vdbl   replacement_group_Ct;
-    vstring       groups;
+      SmartchipParameters parameters,
+      IngestResult        ingest
+    ) : SmartchipParameters(std::move(parameters)), ingested(std::move(ingest)) {
+      construct_extract();
+    }
+
+    IngestResult  ingested;
+    ExtractResult extracted;
 
   private:
     void construct_extract();
-    std::vector<std::string> id = {assay_colname, sample_colname};
-    void extract_assay();
-    void extract_groups();
 };
 
+// rows handed in by the caller are used as they are; otherwise the chip is
+// read from `data`.
 void SmartchipExtract::construct_extract() {
-  // check_Smartchip_headers();
-  assay_group       = map_variable_vec(data, {assay_colname}, id);
-  group_assay       = map_variable(data, id, assay_colname);
-  group_Ct          = map_variable_vec_numeric(data, id, {ct_colname});
-  Ct_means          = um_mean(group_Ct);
-  array_Ct          = map_variable_vec_numeric(data, {assay_colname}, {ct_colname});
-  Ct_perc_below     = um_percent_below_threshold(array_Ct, 33);
-  Ct_sd             = um_sd(group_Ct);
-  group_sample      = map_variable(data, id, sample_colname);
-  group_efficiency  = um_mean(map_variable_vec_numeric(data, id, {efficiency_colname}));
-  if (!replacement_stds_path.empty()) {
-    replacement_assay_group = map_variable_vec(replacement_stds_path, {assay_colname}, id);
-    replacement_group_Ct    = map_variable_vec_numeric(replacement_stds_path, id, {ct_colname});
-  }
-  extract_assay();
-  extract_groups();
-}
-
-void SmartchipExtract::extract_assay() {
-  for (auto it : assay_group) {assays.push_back(it.first);}
-  std::sort(assays.begin(), assays.end(), [](const std::string& lhs, const std::string& rhs) {
-    const auto result = std::mismatch(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(), 
-      [](const unsigned char lhs, const unsigned char rhs) {return std::tolower(lhs) == std::tolower(rhs);});
-    return result.second != rhs.cend() && (result.first == lhs.cend() || std::tolower(*result.first) < std::tolower(*result.second));
-  });
-}
-
-void SmartchipExtract::extract_groups() {
-  for (auto const& it : group_assay) {groups.push_back(it.first);}
-  std::sort(groups.begin(), groups.end(), [](const std::string& lhs, const std::string& rhs) {
-    const auto result = std::mismatch(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(), 
-      [](const unsigned char lhs, const unsigned char rhs) {return std::tolower(lhs) == std::tolower(rhs);});
-    return result.second != rhs.cend() && (result.first == lhs.cend() || std::tolower(*result.first) < std::tolower(*result.second));
-  });
+  if (ingested.table.colnames.empty()) {ingested = SmartchipStages::ingest(*this);}
+  extracted = SmartchipStages::extract(*this, ingested);
+  if (spatial) {extracted.spatial = SmartchipStages::spatial(*this, ingested);}
+  if (melt)    {extracted.melt    = SmartchipStages::melt(*this, ingested);}
 }
 
 //
@@ -350,148 +889,31 @@ class SmartchipTransform : public SmartchipExtract {
       construct_transform();
     }
     SmartchipTransform(
-      const SmartchipIngest ingest
-    ) : SmartchipTransform(ingest.input_path) {}
-    SmartchipTransform(
-      const SmartchipParameters parameters
-    ) : SmartchipTransform(parameters.input_path) {}
-    SmartchipTransform(
-      const SmartchipExtract extracted
-    ) : SmartchipTransform(extracted.input_path) {}
-
-  // protected:
-    um_str_dbl  NTC_means;
-    um_str_dbl  STD_means;
-    um_str_str  QC_NTC;
-    um_str_dbl  NEG_means;
-    um_str_str  QC_NEG;
-    um_str_str  std_QC;
-    um_str_dbl  rsqr_map;
-    um_str_dbl  std_efficiency_map;
-    um_str_pair_dbl_dbl regression_map;  
-    um_str_str  group_QC;
-    um_str_vdbl group_copyN;
-
-  private:
-    void construct_transform();
-    void quality_check_NTC(const std::string&);
-    void quality_check_NEG(const std::string&);
-    void quality_check_STD(const std::string&);
-    void quality_check_EFF(const std::string&);
-    void extract_log_value_and_Ct(um_str_vstr, const std::string&, vdouble&, vdouble&);
-    void regression_analysis(const std::string&, const vdouble&, const vdouble&);
-    void calculate_copyN(const std::string&);
-};
-// 
-void SmartchipTransform::construct_transform() {
-  for (auto assay : assays) {
-    vdouble  log_abundances;
-    vdouble  Ct_values;
-    quality_check_NTC(assay);
-    quality_check_NEG(assay);
-    extract_log_value_and_Ct(assay_group, assay, log_abundances, Ct_values);
-    regression_analysis(assay, log_abundances, Ct_values);
-    quality_check_STD(assay);
-    if (std_QC[assay] == "FAIL") {
-      if (replacement_assay_group.find(assay) != replacement_assay_group.end()) {
-        log_abundances.clear();
-        Ct_values.clear();
-        extract_log_value_and_Ct(replacement_assay_group, assay, log_abundances, Ct_values);
-        regression_analysis(assay, log_abundances, Ct_values);
-      }
+      SmartchipParameters parameters
+    ) : SmartchipExtract(std::move(parameters)) {
+      construct_transform();
     }
-  }
-  for (auto group : groups) {
-    quality_check_EFF(group);
-    calculate_copyN(group);
-  }
-}
-
-void SmartchipTransform::quality_check_NTC(const std::string& assay) {
-  NTC_means[assay] = Ct_means[search_vsrting(assay_group[assay], negative_control_id)];
-  STD_means[assay] = Ct_means[search_vsrting(assay_group[assay], standard_id + "1")];
-  if ((NTC_means[assay] - STD_means[assay]) < 3) {
-    QC_NTC[assay] = "FAIL";
-  } else {
-    QC_NTC[assay] = "PASS";
-  }
-}
-
-void SmartchipTransform::quality_check_NEG(const std::string& assay) {
-  if (negative_control_id == "none") {
-    NEG_means[assay] = std::numeric_limits<double>::quiet_NaN();
-    QC_NEG[assay] = "NONE";
-  } else {
-    NEG_means[assay] = Ct_means[search_vsrting(assay_group[assay], negative_control_id)];
-    if (NEG_means[assay] < 35) {
-      QC_NEG[assay] = "FAIL";
-    } else {
-      QC_NEG[assay] = "PASS";
+    SmartchipTransform(
+      SmartchipParameters parameters,
+      IngestResult        ingest
+    ) : SmartchipExtract(std::move(parameters), std::move(ingest)) {
+      construct_transform();
     }
-  }
-}
-
-void SmartchipTransform::quality_check_STD(const std::string &assay) {
-  if (std_efficiency_map[assay] >= efficiency_min 
-    && std_efficiency_map[assay] <= efficiency_max 
-    && rsqr_map[assay] >= r_sqared_threshold) {
-    std_QC[assay] = "PASS";
-  } else {
-    std_QC[assay] = "FAIL";
-  }
-}
-
-void SmartchipTransform::extract_log_value_and_Ct(
-  um_str_vstr assay_group,
-  const std::string& assay, 
-  vdouble& log_abundances, 
-  vdouble& Ct_values
-) {
-  for (auto group : assay_group[assay]) {
-    if (group.find(standard_id) != std::string::npos) {
-      char log_abundance_value = group.back();
-      vdouble group_Cts = group_Ct[group];
-      Ct_values.insert(std::end(Ct_values), std::begin(group_Cts), std::end(group_Cts));
-      for (int i=0; i < group_Cts.size(); i++) {
-        log_abundances.push_back(log_abundance_value - 48);
-      }
+    SmartchipTransform(
+      SmartchipExtract&& extract
+    ) : SmartchipExtract(std::move(extract)) {
+      construct_transform();
     }
-  }
-}
 
-void SmartchipTransform::regression_analysis(const std::string& assay, const vdouble& log_abundances, const vdouble& Ct_values) {
-  if (std::none_of(Ct_values.begin(), Ct_values.end(), [](double ct) {return !std::isnan(ct);})) {
-    regression_map[assay]     = {0,0};
-    rsqr_map[assay]           = 0;
-    std_efficiency_map[assay] = 0;
-  } else {
-    regression_map[assay]     = lm(log_abundances, Ct_values);
-    rsqr_map[assay]           = coef_determination(log_abundances, Ct_values);
-    std_efficiency_map[assay] = std::pow(10, -1/regression_map[assay].second);
-  }
-}
+    TransformResult transformed;
 
-void SmartchipTransform::quality_check_EFF(const std::string& group) {
-  if (group_efficiency[group] >= efficiency_min) {
-    group_QC[group] = "PASS";
-  } else {
-    group_QC[group] = "FAIL";
-  }
-}
+    // re-runs QC and regression with the current parameters on the data
+    // already extracted; nothing is read from disk.
+    void construct_transform();
+};
 
-void SmartchipTransform::calculate_copyN(const std::string& group) {
-  float gene_coefficient;
-  std::string a = group_assay[group];
-  vdouble copy_N;
-  for (auto Ct : group_Ct[group]) {
-    double N = std::pow(10, (Ct - regression_map[a].first)/regression_map[a].second);
-    copy_N.push_back(N);
-  }
-  if (gene_magnitudes.find(a) != gene_magnitudes.end()) {
-    gene_coefficient = gene_magnitudes[a];
-  } else { gene_coefficient = 1; }
-  copy_N = magnify(copy_N, gene_coefficient);
-  group_copyN[group] = copy_N;
+void SmartchipTransform::construct_transform() {
+  transformed = SmartchipStages::transform(*this, extracted);
 }
 
 //
@@ -506,33 +928,164 @@ class SmartchipAnalyzer : public SmartchipTransform {
       construct_load();
     }
     SmartchipAnalyzer(
-      const SmartchipIngest ingest
-    ) : SmartchipTransform(ingest.input_path) {}
+      SmartchipParameters parameters
+    ) : SmartchipTransform(std::move(parameters)) {
+      construct_load();
+    }
     SmartchipAnalyzer(
-      const SmartchipParameters parameters
-    ) : SmartchipTransform(parameters.input_path) {}
+      SmartchipParameters parameters,
+      IngestResult        ingest
+    ) : SmartchipTransform(std::move(parameters), std::move(ingest)) {
+      construct_load();
+    }
     SmartchipAnalyzer(
-      const SmartchipExtract extracted
-    ) : SmartchipAnalyzer(extracted.input_path) {}
+      SmartchipExtract&& extract
+    ) : SmartchipTransform(std::move(extract)) {
+      construct_load();
+    }
     SmartchipAnalyzer(
-      const SmartchipTransform transformed
-    ) : SmartchipAnalyzer(transformed.input_path) {}
+      SmartchipTransform&& transform
+    ) : SmartchipTransform(std::move(transform)) {
+      construct_load();
+    }
 
     void build_reports();
+    chip_reports collect_reports();
 
   private:
     void construct_load();
+    void write_well_audit();
 };
 
 void SmartchipAnalyzer::construct_load() {
 }
 
 void SmartchipAnalyzer::build_reports() {
+  SmartchipProfile::ScopedStage stage(chip_name, "reports");
   SmartchipInfra::make_dir(output_dir);
-  create_reports(output_file, assays, 
-    groups, group_QC, group_assay, group_sample, group_copyN, Ct_perc_below,
-    regression_map, group_efficiency, std_efficiency_map, rsqr_map, 
-    std_QC, NEG_means, QC_NEG, NTC_means, STD_means, QC_NTC);
+  const ExtractResult&   e = extracted;
+  const TransformResult& t = transformed;
+  create_reports(output_file, e.assays, 
+    e.groups, t.group_QC, e.group_assay, e.group_sample, t.group_copyN, e.Ct_perc_below,
+    t.regression_map, e.group_efficiency, t.std_efficiency_map, t.rsqr_map, 
+    t.std_QC, t.NEG_means, t.QC_NEG, t.NTC_means, t.STD_means, t.QC_NTC, t.group_LOQ,
+    e.melt.group_Tm, e.melt.group_melt);
+  if (estimate_limits) {
+    create_detection_report(output_file, e.assays, t.detection_limits, gene_magnitudes);
+  }
+  if (robust_method != robust_weight::none) {
+    create_robust_fit_report(output_file, e.assays, t.downweighted_wells);
+  }
+  if (outlier_test != SmartchipOutliers::method::none) {
+    SmartchipOutliers::write_report(output_file, e.rejected, e.group_assay, e.group_sample, outlier_test);
+  }
+  if (spatial) {
+    SmartchipSpatial::write_report(output_file, e.spatial, ingested.table, ingested.columns.assay, ingested.columns.sample);
+  }
+  if (audit) {write_well_audit();}
+}
+
+// One line per well in table order, from its raw Ct to the copy number it
+// contributes, with the reason it was left out if it was. Curve_source is
+// the assay's curve behind every copy number. Replicate positions follow
+// table order, as in group_Ct.
+void SmartchipAnalyzer::write_well_audit() {
+  const csv_table&       table   = ingested.table;
+  const SmartchipParameters::column_indices& columns = ingested.columns;
+  const ExtractResult&   e = extracted;
+  const TransformResult& t = transformed;
+  auto position = [&](const std::string& name) {
+    auto column = table.colnames.find(name);
+    return column == table.colnames.end() ? -1 : column->second;
+  };
+  const int row_column = position(row_colname), column_column = position(column_colname);
+
+  std::unordered_map<std::string, std::vector<int> > rejected;
+  for (const auto& well : e.rejected) {rejected[well.group].push_back(well.replicate - 1);}
+  std::unordered_map<int, std::string> spatial_reason;
+  for (const auto& well : e.spatial.wells) {spatial_reason[well.table_row] = well.reason;}
+  std::unordered_map<std::string, int> replicates;
+
+  std::unique_ptr<std::ostream> audit_stream = SdsCompress::open_output(output_file + "_well_audit.csv");
+  std::ostream& audit_file = *audit_stream;
+  audit_file
+    << "Row,Column,Assay,Sample,Raw_Ct,Ct_used,Role,In_curve,Curve_source,"
+    << "Copy_N,Gene_coefficient,Exclusion\n";
+  for (std::size_t r = 0; r < table.rows.size(); ++r) {
+    const csv_row& row = table.rows[r];
+    const std::string& assay  = csv_field(row, columns.assay);
+    const std::string& sample = csv_field(row, columns.sample);
+    const std::string  group  = assay + sample;
+    const int replicate = replicates[group]++;
+    const vdouble& Cts    = um_at(e.group_Ct, group);
+    const double Ct_used  = replicate < static_cast<int>(Cts.size()) ? Cts[replicate]
+      : std::numeric_limits<double>::quiet_NaN();
+    auto magnitude = gene_magnitudes.find(assay);
+    const float coefficient = magnitude != gene_magnitudes.end() ? magnitude->second : 1;
+    // as calculate_copyN, which keeps only the group's surviving values
+    const std::pair<double, double>& fit = um_at(t.regression_map, assay);
+    double copy_N = coefficient * std::pow(10, (Ct_used - fit.first)/fit.second);
+
+    std::string role = "sample";
+    if (group.find(standard_id) != std::string::npos) {role = "standard";}
+    else if (group.find(non_template_id) != std::string::npos) {role = "NTC";}
+    else if (negative_control_id != "none" && group.find(negative_control_id) != std::string::npos) {role = "NEG";}
+    const bool replaced = um_at(t.std_QC, assay) == "FAIL"
+      && e.replacement_assay_group.find(assay) != e.replacement_assay_group.end();
+    const bool in_curve = role == "standard" && !replaced && !std::isnan(Ct_used);
+
+    std::string exclusion;
+    auto add = [&](const std::string& reason) {exclusion += (exclusion.empty() ? "" : ";") + reason;};
+    if (!ingested.flags.empty() && (ingested.flags[r] & exclude_flags)) {
+      add("flags:" + SmartchipFlags::describe(ingested.flags[r] & exclude_flags));
+    }
+    const std::vector<int>& outliers = um_at(rejected, group);
+    if (std::find(outliers.begin(), outliers.end(), replicate) != outliers.end()) {
+      add("outlier:" + SmartchipOutliers::method_name(outlier_test));
+    }
+    auto spatial_well = spatial_reason.find(static_cast<int>(r));
+    if (spatial_well != spatial_reason.end()) {
+      add("spatial:" + spatial_well->second);
+      copy_N = std::numeric_limits<double>::quiet_NaN();
+    }
+    if (exclusion.empty() && std::isnan(Ct_used)) {add("no Ct");}
+
+    audit_file
+      << csv_field(row, row_column) << ","
+      << csv_field(row, column_column) << ","
+      << assay << ","
+      << sample << ","
+      << csv_field(row, columns.ct) << ","
+      << Ct_used << ","
+      << role << ","
+      << (in_curve ? "yes" : "no") << ","
+      << (replaced ? "replacement" : "primary") << ","
+      << copy_N << ","
+      << coefficient << ","
+      << exclusion << "\n";
+  }
+}
+
+chip_reports SmartchipAnalyzer::collect_reports() {
+  SmartchipProfile::ScopedStage stage(chip_name, "reports");
+  const ExtractResult&   e = extracted;
+  const TransformResult& t = transformed;
+  chip_reports reports;
+  reports.chip  = chip_name;
+  reports.limits = estimate_limits;
+  reports.melt  = melt;
+  reports.assay = assay_report_rows(e.assays, t.std_efficiency_map, t.regression_map, t.rsqr_map,
+    t.std_QC, t.NEG_means, t.QC_NEG, t.NTC_means, t.STD_means, t.QC_NTC, e.Ct_perc_below);
+  reports.LIMS  = LIMS_report_rows(e.groups, t.group_QC, e.group_assay, e.group_sample,
+    t.group_copyN, e.group_efficiency, e.melt.group_Tm, e.melt.group_melt);
+  reports.full  = full_report_rows(e.groups, t.group_QC, e.group_assay, e.group_sample,
+    t.group_copyN, e.group_efficiency, t.std_efficiency_map, t.rsqr_map,
+    t.std_QC, t.NEG_means, t.QC_NEG, t.NTC_means, t.STD_means, t.QC_NTC, t.group_LOQ,
+    e.melt.group_Tm, e.melt.group_melt);
+  if (estimate_limits) {
+    reports.detection = detection_report_rows(e.assays, t.detection_limits, gene_magnitudes);
+  }
+  return reports;
 }
 
 #endif
@@ -0,0 +1,325 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: plate-position model of the chip for spatial dispense effects
+ *
+ */
+
+#ifndef SPATIAL
+#define SPATIAL
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "maths_sds.hpp"
+#include "maps_sds.hpp"
+#include "compress_sds.hpp"
+
+// Wells sit on a 72 x 72 grid kept as dense row-major arrays, one per value.
+// Each well's Ct and efficiency are taken relative to the median of its
+// replicates, so what remains is position, not sample or assay. Medians of
+// those residuals are computed per row, per column (from a transposed copy,
+// so both passes walk contiguous memory), per dispense nozzle (rows or
+// columns sharing index mod 8) and for the plate edge against the interior.
+// A lane is flagged when its median is a robust outlier among lanes of its
+// kind (|z| >= 3.5 on the MAD scale) and shifted by at least 1 cycle (Ct) or
+// 0.1 (efficiency); the edge is flagged on the shift alone. Wells in a
+// flagged lane that are themselves shifted the same way by at least half
+// that amount are flagged and left out of their group's copy numbers.
+// A lane effect is only visible where a group's replicates span the lane:
+// replicates dispensed side by side in one row shift together and leave
+// no row residual.
+namespace SmartchipSpatial {
+  const int plate_rows    = 72;
+  const int plate_columns = 72;
+  const int nozzles       = 8;
+
+  // table row behind each well, -1 where the chip has no well
+  struct well_grid {
+    std::vector<int> table_row;
+
+    bool empty() const {return table_row.empty();}
+  };
+
+  struct lane {
+    std::string kind;
+    int         index;
+    std::string metric;
+    int         wells;
+    double      median_residual;
+    double      z;
+    bool        flagged;
+  };
+
+  struct flagged_well {
+    int         row;
+    int         column;
+    int         table_row;
+    double      Ct;
+    double      Ct_residual;
+    double      efficiency;
+    double      efficiency_residual;
+    std::string reason;
+  };
+
+  struct plate_model {
+    std::vector<lane>         lanes;
+    std::vector<flagged_well> wells;
+    // per group, flagged wells as indices into group_Ct
+    std::unordered_map<std::string, std::vector<int> > excluded_replicates;
+  };
+
+  well_grid build_grid(const csv_table& table, int row_column, int column_column, const std::string& source) {
+    well_grid grid;
+    grid.table_row.assign(plate_rows * plate_columns, -1);
+    for (std::size_t i = 0; i < table.rows.size(); ++i) {
+      const std::string& row_field    = csv_field(table.rows[i], row_column);
+      const std::string& column_field = csv_field(table.rows[i], column_column);
+      if (!is_numeric(row_field) || !is_numeric(column_field)) {
+        throw std::invalid_argument("'" + source + "' data row " + std::to_string(i + 1) + " has no well position.");
+      }
+      int r = std::stoi(row_field), c = std::stoi(column_field);
+      if (r < 1 || r > plate_rows || c < 1 || c > plate_columns) {
+        throw std::invalid_argument("'" + source + "' data row " + std::to_string(i + 1) + ": well "
+          + row_field + "," + column_field + " is outside the 72 x 72 chip.");
+      }
+      int& well = grid.table_row[(r - 1) * plate_columns + (c - 1)];
+      if (well >= 0) {
+        throw std::invalid_argument("'" + source + "' data row " + std::to_string(i + 1) + ": well "
+          + row_field + "," + column_field + " appears more than once.");
+      }
+      well = static_cast<int>(i);
+    }
+    return grid;
+  }
+
+  // median of the finite values; reorders `values`
+  double median_in_place(std::vector<double>& values) {
+    values.erase(std::remove_if(values.begin(), values.end(),
+      [](double v) {return !std::isfinite(v);}), values.end());
+    if (values.empty()) {return std::numeric_limits<double>::quiet_NaN();}
+    auto middle = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), middle, values.end());
+    double upper = *middle;
+    if (values.size() % 2) {return upper;}
+    return (*std::max_element(values.begin(), middle) + upper) / 2;
+  }
+
+  // value minus the median of its group's wells; NaN for groups with fewer
+  // than two finite values
+  std::vector<double> group_residuals(const std::vector<double>& values, const std::vector<int>& group, int groups) {
+    std::vector<std::vector<double> > members(groups);
+    for (std::size_t w = 0; w < values.size(); ++w) {
+      if (group[w] >= 0 && std::isfinite(values[w])) {members[group[w]].push_back(values[w]);}
+    }
+    std::vector<double> medians(groups, std::numeric_limits<double>::quiet_NaN());
+    for (int g = 0; g < groups; ++g) {
+      if (members[g].size() >= 2) {medians[g] = median_in_place(members[g]);}
+    }
+    std::vector<double> residuals(values.size(), std::numeric_limits<double>::quiet_NaN());
+    for (std::size_t w = 0; w < values.size(); ++w) {
+      if (group[w] >= 0) {residuals[w] = values[w] - medians[group[w]];}
+    }
+    return residuals;
+  }
+
+  // median residual of each lane in `lanes` rows of `width` contiguous wells
+  void lane_medians(const std::vector<double>& residuals, int lanes, int width,
+    std::vector<double>& medians, std::vector<int>& counts) {
+    std::vector<double> values;
+    medians.assign(lanes, std::numeric_limits<double>::quiet_NaN());
+    counts.assign(lanes, 0);
+    for (int l = 0; l < lanes; ++l) {
+      values.assign(residuals.begin() + l * width, residuals.begin() + (l + 1) * width);
+      medians[l] = median_in_place(values);
+      counts[l]  = static_cast<int>(values.size());
+    }
+  }
+
+  // robust z of each lane median against the other lanes of its kind
+  void score_lanes(const std::string& kind, const std::string& metric, const std::vector<double>& medians,
+    const std::vector<int>& counts, double min_shift, std::vector<lane>& lanes) {
+    std::vector<double> centre_values(medians);
+    const double centre = median_in_place(centre_values);
+    std::vector<double> deviations;
+    for (double m : medians) {
+      if (std::isfinite(m)) {deviations.push_back(std::fabs(m - centre));}
+    }
+    const double scale = 1.4826 * median_in_place(deviations);
+    for (std::size_t l = 0; l < medians.size(); ++l) {
+      if (!counts[l]) {continue;}
+      const double shift = medians[l] - centre;
+      double z = scale > 0 ? shift / scale
+        : shift == 0 ? 0 : std::copysign(std::numeric_limits<double>::infinity(), shift);
+      lanes.push_back(lane{kind, static_cast<int>(l) + 1, metric, counts[l], shift, z,
+        std::fabs(z) >= 3.5 && std::fabs(shift) >= min_shift});
+    }
+  }
+
+  plate_model analyze(
+    const csv_table&        table,
+    const well_grid&        grid,
+    int                     Ct_column,
+    int                     efficiency_column,
+    const std::vector<int>& id
+  ) {
+    const int wells = plate_rows * plate_columns;
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> Ct(wells, nan), efficiency(wells, nan);
+    std::vector<int>    group(wells, -1);
+    // groups and replicate numbers follow table order, as group_Ct does
+    std::unordered_map<std::string, int> group_index;
+    vstring group_keys;
+    std::vector<int> row_group(table.rows.size()), replicate(table.rows.size()), replicates;
+    for (std::size_t i = 0; i < table.rows.size(); ++i) {
+      std::string key;
+      for (int column : id) {key.append(csv_field(table.rows[i], column));}
+      auto it = group_index.emplace(key, static_cast<int>(group_keys.size()));
+      if (it.second) {
+        group_keys.push_back(key);
+        replicates.push_back(0);
+      }
+      row_group[i] = it.first->second;
+      replicate[i] = replicates[row_group[i]]++;
+    }
+    for (int w = 0; w < wells; ++w) {
+      if (grid.table_row[w] < 0) {continue;}
+      const csv_row& row = table.rows[grid.table_row[w]];
+      group[w] = row_group[grid.table_row[w]];
+      const std::string& Ct_field  = csv_field(row, Ct_column);
+      const std::string& eff_field = csv_field(row, efficiency_column);
+      // parsed as map_variable_vec_numeric does
+      Ct[w]         = std::stof(Ct_field.empty()  ? "NAN" : Ct_field);
+      efficiency[w] = std::stof(eff_field.empty() ? "NAN" : eff_field);
+    }
+    const int groups = static_cast<int>(group_keys.size());
+
+    struct metric_plane {
+      std::string          name;
+      double               min_shift;
+      std::vector<double>  residuals;
+    };
+    std::vector<metric_plane> planes = {
+      {"Ct",         1.0, group_residuals(Ct, group, groups)},
+      {"Efficiency", 0.1, group_residuals(efficiency, group, groups)},
+    };
+
+    plate_model model;
+    // flagged shift per well and metric, 0 where no flagged lane covers it
+    std::vector<std::vector<double> > well_shift(planes.size(), std::vector<double>(wells, 0));
+    std::vector<std::vector<std::string> > well_reason(planes.size(), std::vector<std::string>(wells));
+    std::vector<double> transposed(wells), medians, values;
+    std::vector<int>    counts;
+    for (std::size_t p = 0; p < planes.size(); ++p) {
+      const std::vector<double>& residuals = planes[p].residuals;
+      const std::string& metric = planes[p].name;
+      const double min_shift    = planes[p].min_shift;
+      auto mark = [&](int w, const lane& l) {
+        if (!l.flagged || well_shift[p][w] != 0) {return;}
+        well_shift[p][w]  = l.median_residual;
+        well_reason[p][w] = l.kind + " " + std::to_string(l.index) + " " + metric;
+      };
+      std::size_t first = model.lanes.size();
+
+      lane_medians(residuals, plate_rows, plate_columns, medians, counts);
+      score_lanes("row", metric, medians, counts, min_shift, model.lanes);
+      for (int r = 0; r < plate_rows; ++r) {
+        for (int c = 0; c < plate_columns; ++c) {transposed[c * plate_rows + r] = residuals[r * plate_columns + c];}
+      }
+      lane_medians(transposed, plate_columns, plate_rows, medians, counts);
+      score_lanes("column", metric, medians, counts, min_shift, model.lanes);
+
+      // nozzle lanes: every 8th row (column) from one row-major (transposed) pass
+      for (int transpose = 0; transpose < 2; ++transpose) {
+        const std::vector<double>& plane = transpose ? transposed : residuals;
+        const int lanes = transpose ? plate_columns : plate_rows;
+        const int width = transpose ? plate_rows : plate_columns;
+        std::vector<std::vector<double> > nozzle_values(nozzles);
+        for (int l = 0; l < lanes; ++l) {
+          std::vector<double>& nozzle = nozzle_values[l % nozzles];
+          nozzle.insert(nozzle.end(), plane.begin() + l * width, plane.begin() + (l + 1) * width);
+        }
+        medians.assign(nozzles, nan);
+        counts.assign(nozzles, 0);
+        for (int n = 0; n < nozzles; ++n) {
+          medians[n] = median_in_place(nozzle_values[n]);
+          counts[n]  = static_cast<int>(nozzle_values[n].size());
+        }
+        score_lanes(transpose ? "column_nozzle" : "row_nozzle", metric, medians, counts, min_shift, model.lanes);
+      }
+
+      std::vector<double> edge, interior;
+      for (int r = 0; r < plate_rows; ++r) {
+        for (int c = 0; c < plate_columns; ++c) {
+          bool on_edge = r == 0 || c == 0 || r == plate_rows - 1 || c == plate_columns - 1;
+          (on_edge ? edge : interior).push_back(residuals[r * plate_columns + c]);
+        }
+      }
+      const double interior_median = median_in_place(interior);
+      const double edge_shift      = median_in_place(edge) - interior_median;
+      if (!edge.empty()) {
+        model.lanes.push_back(lane{"edge", 1, metric, static_cast<int>(edge.size()), edge_shift, nan,
+          std::fabs(edge_shift) >= min_shift});
+      }
+
+      for (std::size_t l = first; l < model.lanes.size(); ++l) {
+        const lane& flagged = model.lanes[l];
+        if (!flagged.flagged) {continue;}
+        for (int r = 0; r < plate_rows; ++r) {
+          for (int c = 0; c < plate_columns; ++c) {
+            bool in_lane =
+                 (flagged.kind == "row"           && r + 1 == flagged.index)
+              || (flagged.kind == "column"        && c + 1 == flagged.index)
+              || (flagged.kind == "row_nozzle"    && r % nozzles + 1 == flagged.index)
+              || (flagged.kind == "column_nozzle" && c % nozzles + 1 == flagged.index)
+              || (flagged.kind == "edge" && (r == 0 || c == 0 || r == plate_rows - 1 || c == plate_columns - 1));
+            if (in_lane) {mark(r * plate_columns + c, flagged);}
+          }
+        }
+      }
+    }
+
+    for (int w = 0; w < wells; ++w) {
+      std::string reason;
+      for (std::size_t p = 0; p < planes.size(); ++p) {
+        const double shift = well_shift[p][w];
+        const double residual = planes[p].residuals[w];
+        if (shift == 0 || !(residual * shift > 0) || std::fabs(residual) < planes[p].min_shift / 2) {continue;}
+        reason += (reason.empty() ? "" : ";") + well_reason[p][w];
+      }
+      if (reason.empty()) {continue;}
+      model.wells.push_back(flagged_well{w / plate_columns + 1, w % plate_columns + 1, grid.table_row[w],
+        Ct[w], planes[0].residuals[w], efficiency[w], planes[1].residuals[w], reason});
+      model.excluded_replicates[group_keys[group[w]]].push_back(replicate[grid.table_row[w]]);
+    }
+    return model;
+  }
+
+  void write_report(const std::string& output, const plate_model& model, const csv_table& table,
+    int assay_column, int sample_column) {
+    std::unique_ptr<std::ostream> lane_stream = SdsCompress::open_output(output + "_spatial_report.csv");
+    std::ostream& lane_file = *lane_stream;
+    lane_file << "Kind,Index,Metric,Wells,Median_residual,Robust_z,Flag\n";
+    for (const auto& l : model.lanes) {
+      lane_file << l.kind << "," << l.index << "," << l.metric << "," << l.wells << ","
+        << l.median_residual << "," << l.z << "," << (l.flagged ? "FLAG" : "PASS") << "\n";
+    }
+    std::unique_ptr<std::ostream> well_stream = SdsCompress::open_output(output + "_spatial_wells.csv");
+    std::ostream& well_file = *well_stream;
+    well_file << "Row,Column,Assay,Sample,Ct,Ct_residual,Efficiency,Efficiency_residual,Reason\n";
+    for (const auto& w : model.wells) {
+      const csv_row& row = table.rows[w.table_row];
+      well_file << w.row << "," << w.column << "," << csv_field(row, assay_column) << ","
+        << csv_field(row, sample_column) << "," << w.Ct << "," << w.Ct_residual << ","
+        << w.efficiency << "," << w.efficiency_residual << "," << w.reason << "\n";
+    }
+  }
+}
+
+#endif // SPATIAL
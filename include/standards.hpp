@@ -0,0 +1,150 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: standard sample concentrations for the standard curves
+ *
+ */
+
+#ifndef STANDARDS
+#define STANDARDS
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cctype>
+#include <limits>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "defs_sds.hpp"
+#include "maps_sds.hpp"
+
+// A standards file is a CSV with a Sample column and, per row, either the
+// standard's Concentration (copies) or its Dilution_factor from the row
+// before it for the same assay, so a series can be given by its top standard:
+//
+//   Assay,Sample,Concentration,Dilution_factor
+//   ,STD1,1e7,
+//   ,STD2,,10
+//   ,STD3,,10
+//   ITS,STD1,5e6,
+//   ITS,STD2,,4
+//
+// The Assay column is optional; a row with an empty assay applies to every
+// assay without rows of its own for that sample. Without a file, a
+// standard's log10 concentration is the number its sample name ends with
+// (STD1 = 1, ..., STD10 = 10); a standard group without one, such as a bare
+// "STD" sample, is left out of the curve with a warning, as it has no
+// concentration to fit. With a file, every standard must be covered.
+//
+// Concentrations are resolved once per chip into a log10 value per standard
+// group, which the standard curves read directly.
+namespace SmartchipStandards {
+  class definition {
+    public:
+      void load(const std::string& path) {
+        csv_table table = read_csv(path);
+        if (table.colnames.empty()) {throw std::invalid_argument("standards file '" + path + "' not found or empty.");}
+        auto column = [&](const std::string& name) {
+          auto found = table.colnames.find(name);
+          return found == table.colnames.end() ? -1 : found->second;
+        };
+        const int assay_column    = column("Assay");
+        const int sample_column   = column("Sample");
+        const int conc_column     = column("Concentration");
+        const int dilution_column = column("Dilution_factor");
+        if (sample_column < 0 || (conc_column < 0 && dilution_column < 0)) {
+          throw std::invalid_argument("standards file '" + path
+            + "' needs a Sample column and a Concentration or Dilution_factor column.");
+        }
+        std::unordered_map<std::string, double> previous;
+        for (std::size_t r = 0; r < table.rows.size(); ++r) {
+          const csv_row& row = table.rows[r];
+          auto where = [&]() {return "standards file '" + path + "' data row " + std::to_string(r + 1) + ": ";};
+          const std::string& assay    = csv_field(row, assay_column);
+          const std::string& sample   = csv_field(row, sample_column);
+          const std::string& conc     = csv_field(row, conc_column);
+          const std::string& dilution = csv_field(row, dilution_column);
+          if (sample.empty()) {continue;}
+          double log_conc;
+          try {
+            if (!conc.empty()) {
+              log_conc = std::log10(std::stod(conc));
+            } else if (!dilution.empty()) {
+              auto before = previous.find(assay);
+              if (before == previous.end()) {
+                throw std::invalid_argument(where() + "a dilution needs a concentration on an earlier row.");
+              }
+              log_conc = before->second - std::log10(std::stod(dilution));
+            } else {
+              throw std::invalid_argument(where() + "'" + sample + "' has no Concentration or Dilution_factor.");
+            }
+          }
+          catch (const std::invalid_argument&) {throw;}
+          catch (const std::exception&) {
+            throw std::invalid_argument(where() + "invalid number for '" + sample + "'.");
+          }
+          if (!std::isfinite(log_conc)) {
+            throw std::invalid_argument(where() + "'" + sample + "' concentration must be positive.");
+          }
+          previous[assay] = log_conc;
+          (assay.empty() ? any_assay : by_assay)[assay + '\t' + sample] = log_conc;
+        }
+        loaded = true;
+      }
+
+      bool from_file() const {return loaded;}
+
+      // log10 concentration of `sample` for `assay`; NaN when undefined
+      double log_concentration(const std::string& assay, const std::string& sample) const {
+        if (!loaded) {return trailing_number(sample);}
+        auto found = by_assay.find(assay + '\t' + sample);
+        if (found != by_assay.end()) {return found->second;}
+        found = any_assay.find('\t' + sample);
+        return found != any_assay.end() ? found->second : std::numeric_limits<double>::quiet_NaN();
+      }
+
+    private:
+      bool        loaded = false;
+      um_str_dbl  by_assay;
+      um_str_dbl  any_assay;
+
+      static double trailing_number(const std::string& sample) {
+        std::size_t begin = sample.size();
+        while (begin > 0 && std::isdigit(static_cast<unsigned char>(sample[begin - 1]))) {--begin;}
+        if (begin == sample.size()) {return std::numeric_limits<double>::quiet_NaN();}
+        return std::stod(sample.substr(begin));
+      }
+  };
+
+  // log10 concentration of every standard group of `assay_group`
+  um_str_dbl resolve(
+    const definition&   standards,
+    const um_str_vstr&  assay_group,
+    const um_str_str&   group_sample,
+    const std::string&  standard_id,
+    const std::string&  source
+  ) {
+    um_str_dbl log_abundance;
+    for (const auto& assay_groups : assay_group) {
+      for (const auto& group : assay_groups.second) {
+        if (group.find(standard_id) == std::string::npos) {continue;}
+        const std::string& sample = um_at(group_sample, group);
+        double value = standards.log_concentration(assay_groups.first, sample);
+        if (std::isnan(value)) {
+          const std::string message = "'" + source + "': no concentration for standard '" + sample
+            + "' of assay '" + assay_groups.first + "'";
+          if (standards.from_file()) {throw std::invalid_argument(message + ".");}
+          std::cerr << "Warning: " + message + "; left out of the standard curve." << std::endl;
+          continue;
+        }
+        log_abundance[group] = value;
+      }
+    }
+    return log_abundance;
+  }
+}
+
+#endif // STANDARDS
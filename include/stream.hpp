@@ -0,0 +1,104 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: chip-at-a-time processing of multi-chip archive exports
+ *
+ */
+
+#ifndef STREAM
+#define STREAM
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <stdexcept>
+
+#include "scaclass.cpp"
+
+// An archive is a single export holding several chips, with rows grouped by
+// a chip (or run) ID column. Rows are read one line at a time and collected
+// for the current chip only; when the ID changes that chip is transformed,
+// its reports are written and its rows are released before the next chip is
+// read, so memory is bounded by the largest chip rather than the archive.
+// Each chip's rows live in its own arena scope, and its reports are
+// committed as their own output unit, so a failure later in the archive
+// leaves the chips already written in place.
+namespace SmartchipStream {
+  std::string file_safe(const std::string& id) {
+    std::string safe = id.empty() ? "NA" : id;
+    for (char& c : safe) {
+      if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '.' && c != '_') {c = '_';}
+    }
+    return safe;
+  }
+
+  void process_chip(const SmartchipParameters& settings, const std::string& chip_id, csv_table&& chip) {
+    SmartchipParameters params(settings);
+    params.chip_name    = settings.chip_name + "_" + file_safe(chip_id);
+    params.output_file  = settings.output_file + "_" + file_safe(chip_id);
+    SdsCompress::output_unit unit;
+    IngestResult ingested = SmartchipStages::ingest(params, std::move(chip));
+    SmartchipAnalyzer sma_report(std::move(params), std::move(ingested));
+    sma_report.build_reports();
+    unit.commit();
+  }
+
+  int process_archive(const SmartchipParameters& settings, const std::string& chip_column) {
+    std::unique_ptr<std::istream> archive_stream = SdsCompress::open_input(settings.data);
+    std::istream& archive = *archive_stream;
+    std::string line;
+    if (!std::getline(archive, line)) {
+      throw std::invalid_argument("'" + settings.data + "' is empty.");
+    }
+    SmartchipProfile::record_read(line.size() + 1);
+    csv_table header;
+    vstring names = string_split(line, ',');
+    for (std::size_t i = 0; i < names.size(); ++i) {header.colnames[names[i]] = i;}
+    if (header.colnames.find(chip_column) == header.colnames.end()) {
+      throw std::invalid_argument("'" + settings.data + "' missing required field '" + chip_column + "'.");
+    }
+    const std::size_t chip_col = header.colnames[chip_column];
+    settings.resolve_columns(header, settings.data);
+
+    // each chip's rows are read into its own arena scope, released once the
+    // chip is reported; `fields` is reused from line to line
+    std::unique_ptr<SmartchipArena::chip_scope> arena;
+    std::unique_ptr<csv_table> chip;
+    csv_row fields;
+    std::unordered_set<std::string> finished;
+    std::string current;
+    int chips = 0;
+    auto finish_chip = [&]() {
+      process_chip(settings, current, std::move(*chip));
+      chip.reset();
+      arena.reset();
+      finished.insert(current);
+      ++chips;
+    };
+    while (std::getline(archive, line)) {
+      SmartchipProfile::record_read(line.size() + 1);
+      fields.clear();
+      split_fields(line, ',', fields);
+      std::string id = chip_col < fields.size() ? fields[chip_col] : "";
+      if (!chip || id != current) {
+        if (chip) {finish_chip();}
+        if (finished.count(id)) {
+          throw std::invalid_argument("'" + settings.data + "' is not grouped by '" + chip_column
+            + "': rows for '" + id + "' appear after other chips.");
+        }
+        current = id;
+        arena.reset(new SmartchipArena::chip_scope());
+        chip.reset(new csv_table());
+        chip->colnames = header.colnames;
+      }
+      chip->rows.emplace_back(fields.begin(), fields.end());
+    }
+    if (chip) {finish_chip();}
+    return chips;
+  }
+}
+
+#endif // STREAM
@@ -0,0 +1,212 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: QC threshold sweeps over an already transformed chip
+ *
+ */
+
+#ifndef SWEEP
+#define SWEEP
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "scaclass.cpp"
+
+// The standard-curve fits and copy numbers do not depend on the efficiency
+// and r-squared thresholds, only the PASS/FAIL calls do. A sweep fits the
+// chip once and then scores every grid point from the fitted values:
+// each threshold axis is compared once per assay, and the per-group
+// efficiency check becomes a binary search in the assay's sorted
+// efficiencies. The swept values stand in for the command line thresholds
+// only: where a --qc-rules rule replaces those for an assay, the rule is
+// applied instead, so each grid point agrees with the QC report a run at
+// those thresholds would write.
+namespace SmartchipSweep {
+  // "start:stop:step", or a single value
+  std::vector<float> parse_range(const std::string& spec, float fallback) {
+    if (spec.empty()) {return {fallback};}
+    vstring parts = string_split(spec, ':');
+    std::vector<double> bounds;
+    try {
+      for (const auto& part : parts) {bounds.push_back(std::stod(part));}
+    }
+    catch (const std::exception&) {
+      throw std::invalid_argument("threshold range '" + spec + "' is not start:stop:step.");
+    }
+    if (bounds.size() == 1) {return {static_cast<float>(bounds[0])};}
+    if (bounds.size() != 3 || bounds[2] <= 0 || bounds[1] < bounds[0]) {
+      throw std::invalid_argument("threshold range '" + spec + "' is not start:stop:step.");
+    }
+    std::vector<float> values;
+    long steps = static_cast<long>(std::floor((bounds[1] - bounds[0]) / bounds[2] + 1e-9));
+    for (long i = 0; i <= steps; ++i) {
+      values.push_back(static_cast<float>(bounds[0] + i * bounds[2]));
+    }
+    return values;
+  }
+
+  struct grid {
+    std::vector<float> efficiency_min;
+    std::vector<float> efficiency_max;
+    std::vector<float> r_squared;
+
+    std::size_t size() const {return efficiency_min.size() * efficiency_max.size() * r_squared.size();}
+  };
+
+  struct counts {
+    vstring           assays;
+    // [assay][point], points ordered efficiency_min, efficiency_max, r_squared
+    std::vector<std::vector<int> > standards_pass;
+    std::vector<std::vector<int> > samples_pass;
+    std::vector<int>  samples;
+  };
+
+  // `name` verdict per row from the rules file alone, without the defaults
+  std::vector<char> rule_verdict(
+    const SmartchipRules::rule_set&                 rules,
+    SmartchipRules::scope                           level,
+    const vstring&                                  rows,
+    const std::unordered_map<int, const vdouble*>&  columns,
+    const std::string&                              name
+  ) {
+    std::vector<SmartchipRules::predicate> predicates;
+    for (auto& p : rules.compile(level, rows, {})) {
+      if (SmartchipRules::metrics()[p.metric].verdict == name) {predicates.push_back(std::move(p));}
+    }
+    auto verdicts = SmartchipRules::evaluate(predicates, columns, rows.size());
+    auto found = verdicts.find(name);
+    return found == verdicts.end() ? std::vector<char>(rows.size(), 1) : found->second;
+  }
+
+  counts evaluate(
+    const ExtractResult&            extracted,
+    const TransformResult&          transformed,
+    const grid&                     thresholds,
+    const SmartchipRules::rule_set& rules
+  ) {
+    const std::size_t n_min = thresholds.efficiency_min.size();
+    const std::size_t n_max = thresholds.efficiency_max.size();
+    const std::size_t n_rsq = thresholds.r_squared.size();
+    auto metric = SmartchipRules::metric_index;
+    const int std_efficiency    = metric("STD_efficiency");
+    const int std_rsqr          = metric("Rsqr");
+    const int sample_efficiency = metric("sample_efficiency");
+
+    vdouble assay_efficiency, assay_rsqr;
+    for (const auto& assay : extracted.assays) {
+      assay_efficiency.push_back(um_at(transformed.chip_std_efficiency, assay));
+      assay_rsqr.push_back(um_at(transformed.chip_rsqr_map, assay));
+    }
+    std::vector<char> std_rules = rule_verdict(rules, SmartchipRules::scope::assay, extracted.assays,
+      {{std_efficiency, &assay_efficiency}, {std_rsqr, &assay_rsqr}}, "QC_StdCurve");
+
+    vstring group_assays;
+    vdouble group_efficiency;
+    for (const auto& group : extracted.groups) {
+      group_assays.push_back(um_at(extracted.group_assay, group));
+      group_efficiency.push_back(um_at(extracted.group_efficiency, group));
+    }
+    std::vector<char> sample_rules = rule_verdict(rules, SmartchipRules::scope::group, group_assays,
+      {{sample_efficiency, &group_efficiency}}, "QCSample");
+
+    // groups whose efficiency is judged by the swept minimum are searched;
+    // the others pass or fail on the rules file alone. NaN efficiencies
+    // always FAIL the minimum, so only the numeric ones are kept.
+    um_str_vdbl swept_efficiencies;
+    std::unordered_map<std::string, int> group_count, rules_pass;
+    for (std::size_t g = 0; g < extracted.groups.size(); ++g) {
+      const std::string& assay = group_assays[g];
+      ++group_count[assay];
+      if (!sample_rules[g]) {continue;}
+      if (!rules.uses_default(sample_efficiency, assay)) {
+        ++rules_pass[assay];
+      } else if (!std::isnan(group_efficiency[g])) {
+        swept_efficiencies[assay].push_back(group_efficiency[g]);
+      }
+    }
+    counts result;
+    result.assays = extracted.assays;
+    for (std::size_t a = 0; a < extracted.assays.size(); ++a) {
+      const std::string& assay = extracted.assays[a];
+      double efficiency = assay_efficiency[a];
+      double rsqr       = assay_rsqr[a];
+      vdouble& groups   = swept_efficiencies[assay];
+      std::sort(groups.begin(), groups.end());
+      // a rule for the metric replaces the swept threshold, as it replaces
+      // the command line one in the QC report
+      const bool sweep_efficiency = rules.uses_default(std_efficiency, assay);
+      const bool sweep_rsqr       = rules.uses_default(std_rsqr, assay);
+
+      std::vector<char> min_ok(n_min), max_ok(n_max), rsq_ok(n_rsq);
+      std::vector<int>  eff_pass(n_min);
+      for (std::size_t i = 0; i < n_min; ++i) {
+        min_ok[i]   = !sweep_efficiency || efficiency >= thresholds.efficiency_min[i];
+        eff_pass[i] = rules_pass[assay] + static_cast<int>(groups.end()
+          - std::lower_bound(groups.begin(), groups.end(), static_cast<double>(thresholds.efficiency_min[i])));
+      }
+      for (std::size_t j = 0; j < n_max; ++j) {max_ok[j] = !sweep_efficiency || efficiency <= thresholds.efficiency_max[j];}
+      for (std::size_t k = 0; k < n_rsq; ++k) {rsq_ok[k] = !sweep_rsqr || rsqr >= thresholds.r_squared[k];}
+
+      std::vector<int> standards(thresholds.size());
+      std::vector<int> samples(thresholds.size());
+      std::size_t point = 0;
+      for (std::size_t i = 0; i < n_min; ++i) {
+        for (std::size_t j = 0; j < n_max; ++j) {
+          for (std::size_t k = 0; k < n_rsq; ++k, ++point) {
+            standards[point] = std_rules[a] && min_ok[i] && max_ok[j] && rsq_ok[k];
+            samples[point]   = eff_pass[i];
+          }
+        }
+      }
+      result.standards_pass.push_back(std::move(standards));
+      result.samples_pass.push_back(std::move(samples));
+      result.samples.push_back(group_count[assay]);
+    }
+    return result;
+  }
+
+  // One row per assay and grid point, followed by an "ALL" row per grid
+  // point summed over assays.
+  void write_report(const std::string& output, const grid& thresholds, const counts& swept) {
+    std::unique_ptr<std::ostream> sweep_stream = SdsCompress::open_output(output + "_threshold_sweep.csv");
+    std::ostream& sweep_file = *sweep_stream;
+    sweep_file
+      << "Assay,efficiency_min,efficiency_max,r_squared_min,"
+      << "standards_PASS,standards_FAIL,samples_PASS,samples_FAIL\n";
+    std::vector<int> all_standards(thresholds.size());
+    std::vector<int> all_samples(thresholds.size());
+    int total_samples = 0;
+    auto write_rows = [&](const std::string& assay, const std::vector<int>& standards,
+      int n_standards, const std::vector<int>& samples, int n_samples) {
+      std::size_t point = 0;
+      for (float eff_min : thresholds.efficiency_min) {
+        for (float eff_max : thresholds.efficiency_max) {
+          for (float rsq : thresholds.r_squared) {
+            sweep_file << assay << "," << eff_min << "," << eff_max << "," << rsq << ","
+              << standards[point] << "," << n_standards - standards[point] << ","
+              << samples[point] << "," << n_samples - samples[point] << "\n";
+            ++point;
+          }
+        }
+      }
+    };
+    for (std::size_t a = 0; a < swept.assays.size(); ++a) {
+      write_rows(swept.assays[a], swept.standards_pass[a], 1, swept.samples_pass[a], swept.samples[a]);
+      for (std::size_t p = 0; p < thresholds.size(); ++p) {
+        all_standards[p] += swept.standards_pass[a][p];
+        all_samples[p]   += swept.samples_pass[a][p];
+      }
+      total_samples += swept.samples[a];
+    }
+    write_rows("ALL", all_standards, static_cast<int>(swept.assays.size()), all_samples, total_samples);
+  }
+}
+
+#endif // SWEEP
@@ -0,0 +1,88 @@
+/*
+ *
+ * Author:  Schuyler D. Smith
+ * Function:  smart_chip_analyzer
+ * Purpose: fixed-size worker pool for per-chip jobs
+ *
+ */
+
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool {
+  public:
+    ThreadPool(unsigned int threads) {
+      if (threads == 0) {threads = default_threads();}
+      for (unsigned int i = 0; i < threads; ++i) {
+        workers.emplace_back([this]() {work();});
+      }
+    }
+    ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      task_ready.notify_all();
+      for (auto& worker : workers) {worker.join();}
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static unsigned int default_threads() {
+      unsigned int n = std::thread::hardware_concurrency();
+      return n ? n : 1;
+    }
+
+    std::size_t size() const {return workers.size();}
+
+    void submit(std::function<void()> task) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(task));
+        ++pending;
+      }
+      task_ready.notify_one();
+    }
+
+    // Blocks until every submitted task has finished.
+    void wait() {
+      std::unique_lock<std::mutex> lock(mutex);
+      all_done.wait(lock, [this]() {return pending == 0;});
+    }
+
+  private:
+    std::vector<std::thread>          workers;
+    std::queue<std::function<void()> > tasks;
+    std::mutex                        mutex;
+    std::condition_variable           task_ready;
+    std::condition_variable           all_done;
+    std::size_t                       pending = 0;
+    bool                              stopping = false;
+
+    void work() {
+      while (true) {
+        std::function<void()> task;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          task_ready.wait(lock, [this]() {return stopping || !tasks.empty();});
+          if (tasks.empty()) {return;}
+          task = std::move(tasks.front());
+          tasks.pop();
+        }
+        task();
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (--pending == 0) {all_done.notify_all();}
+        }
+      }
+    }
+};
+
+#endif // THREAD_POOL
@@ -8,12 +8,22 @@
 
 
 #include "scaclass.cpp"
+#include "stream.hpp"
+#include "sweep.hpp"
+#include "bootstrap.hpp"
+#include "manifest.hpp"
+#include "discover.hpp"
+#include "journal.hpp"
+#include "thread_pool.hpp"
 #include "version.hpp"
 #include <lyra/lyra.hpp>
 #include <iostream>
 #include <sstream>
 #include <vector>
 #include <string>
+#include <mutex>
+#include <algorithm>
+#include <chrono>
 #include <dirent.h>
 #ifndef _WIN32
   #include <sys/stat.h>
@@ -32,8 +42,37 @@ int main(int argc, char *argv[]) {
   float       efficiency_min = 1.70;
   float       efficiency_max = 2.20;
   float       r_sqared_threshold = 0.85;
+  std::string robust = "none";
+  bool        limits = false;
+  float       detection_ct = 35;
+  std::string qc_rules_path;
+  std::string standards_path;
+  bool        spatial = false;
+  bool        melt = false;
+  float       melt_tolerance = 1.5;
+  std::string exclude_flags;
+  std::string outliers = "none";
+  float       outlier_alpha = 0.05;
+  bool        audit = false;
   std::string replacement_stds;
   std::string gene_magnitudes;
+  std::string manifest;
+  bool        recursive = false;
+  bool        incremental = false;
+  bool        resume = false;
+  std::string include_patterns;
+  std::string profile_json;
+  std::string profile_trace;
+  std::string stream_by;
+  bool        aggregate = false;
+  unsigned int threads  = 0;
+  std::string compress;
+  bool        sweep = false;
+  std::string sweep_effmin;
+  std::string sweep_effmax;
+  std::string sweep_rsquare;
+  unsigned int bootstrap = 0;
+  unsigned long long bootstrap_seed = 1;
   // help flag
   bool show_help    = false;
   bool show_version = false;
@@ -43,9 +82,21 @@ int main(int argc, char *argv[]) {
     | lyra::opt([&](bool){ show_version += 1; }) 
       ["-v"]["--version"]
       ("Version information.")
-    | lyra::opt( input, "").required()
+    | lyra::opt( input, "").optional()
       ["-i"]["--input"]
-      ("Input CSV file. Output from the smartchip qPCR. (required)")
+      ("Input CSV file. Output from the smartchip qPCR. (required unless --manifest is given)")
+    | lyra::opt( recursive )
+      ["-D"]["--recursive"]
+      ("With a directory --input, also search its subdirectories (skipping sca_output); with a directory --output, reports mirror the input tree.")
+    | lyra::opt( incremental )
+      ["-U"]["--incremental"]
+      ("Skip chips whose assay QC, LIMS and full reports are newer than the chip and the magnitudes, replacements, QC rules and standards files.")
+    | lyra::opt( resume )
+      ["--resume"]
+      ("Resume an interrupted directory run: skip the chips its journal lists as committed and unchanged since.")
+    | lyra::opt( include_patterns, "*.csv,*.csv.gz,*.csv.zst" ).optional()
+      ["--include"]
+      ("Comma-separated file name patterns for the chips in a directory --input.")
     | lyra::opt( output, "").optional()
       ["-o"]["--output"]
       ("Output directory path (default uses input path), and/or prefix for output files (default uses input filename).")
@@ -67,6 +118,9 @@ int main(int argc, char *argv[]) {
     | lyra::opt( standard_id, "STD")
       ["-s"]["--standard"]
       ("Sample identifiers for the standards.")
+    | lyra::opt( standards_path, "" ).optional()
+      ["--standards"]
+      ("CSV of standard concentrations (Assay, Sample, Concentration or Dilution_factor); by default a standard's log10 concentration is the number ending its sample name.")
     | lyra::opt( non_template_control, "NTC" )
       ["-t"]["--nontemplate"]
       ("Sample identifiers for the non-template controls.")
@@ -79,12 +133,84 @@ int main(int argc, char *argv[]) {
     | lyra::opt( r_sqared_threshold, "0.85" )
       ["-R"]["--rsquare"]
       ("Minimum value for r-squared of Ct value and log-abundances to receive PASS.")
+    | lyra::opt( robust, "none" )
+      ["--robust"]
+      ("Standard curve fit: none (least squares), huber or tukey; robust fits also list the wells given under half weight.")
+    | lyra::opt( limits )
+      ["-L"]["--lod"]
+      ("Estimate each assay's LOD/LOQ from the standards and NTC/NEG wells, and flag samples below them.")
+    | lyra::opt( detection_ct, "35" )
+      ["--detection-ct"]
+      ("Ct at or above which a well counts as not detected for --lod.")
+    | lyra::opt( qc_rules_path, "" ).optional()
+      ["-Q"]["--qc-rules"]
+      ("File of QC rules ('metric op value [assay ...]') overriding the built-in thresholds.")
+    | lyra::opt( spatial )
+      ["--spatial"]
+      ("Model Ct and efficiency by well position (Row/Column), report row, column, nozzle and edge effects, and leave flagged wells out of copy numbers.")
+    | lyra::opt( melt )
+      ["--melt"]
+      ("Check each well's Tm against its assay's standards and add Mean_Tm and QC_Melt to the LIMS and full reports.")
+    | lyra::opt( melt_tolerance, "1.5" )
+      ["--melt-tolerance"]
+      ("Degrees a well's Tm may differ from the standards' median Tm for --melt.")
+    | lyra::opt( exclude_flags, "" ).optional()
+      ["--exclude-flags"]
+      ("Comma-separated instrument flags (e.g. LowEfficiency,CtIsLarge); wells carrying any of them are left out of Cts, standard curves and copy numbers.")
+    | lyra::opt( outliers, "none" )
+      ["--outliers"]
+      ("Replicate outlier test: none, grubbs, dixon or mad; rejected wells are listed in an outlier report and left out of the statistics.")
+    | lyra::opt( outlier_alpha, "0.05" )
+      ["--outlier-alpha"]
+      ("Significance level for --outliers grubbs or dixon (dixon: 0.10, 0.05 or 0.01).")
+    | lyra::opt( audit )
+      ["-W"]["--audit"]
+      ("Also write a per-well audit report tracing each raw Ct to its copy number, with any exclusion reason.")
     | lyra::opt( replacement_stds, "" ).optional()
       ["-r"]["--replacements"]
       ("Replacement values for when standards FAIL quality check.")
     | lyra::opt( gene_magnitudes, "" ).optional()
       ["-m"]["--magnitudes"]
       ("File with maps (gene:value) for gene abundance coefficients.")
+    | lyra::opt( stream_by, "" ).optional()
+      ["-S"]["--stream-by"]
+      ("Treat input as a multi-chip archive grouped by this column (e.g. Chip) and process one chip at a time.")
+    | lyra::opt( aggregate )
+      ["-A"]["--aggregate"]
+      ("Write one consolidated set of reports, with a Chip column, for all chips in the input directory.")
+    | lyra::opt( threads, "0" )
+      ["-j"]["--threads"]
+      ("Number of chips processed in parallel (default: all cores).")
+    | lyra::opt( compress, "none" ).optional()
+      ["-z"]["--compress"]
+      ("Compress the reports: none, gz or zst. Compressed inputs are detected automatically.")
+    | lyra::opt( sweep )
+      ["--sweep"]
+      ("Fit each chip once and write PASS/FAIL counts per assay over a grid of QC thresholds instead of the reports.")
+    | lyra::opt( sweep_effmin, "start:stop:step" ).optional()
+      ["--sweep-effmin"]
+      ("Range of minimum efficiencies for --sweep (default: --effmin).")
+    | lyra::opt( sweep_effmax, "start:stop:step" ).optional()
+      ["--sweep-effmax"]
+      ("Range of maximum efficiencies for --sweep (default: --effmax).")
+    | lyra::opt( sweep_rsquare, "start:stop:step" ).optional()
+      ["--sweep-rsquare"]
+      ("Range of minimum r-squared values for --sweep (default: --rsquare).")
+    | lyra::opt( bootstrap, "0" )
+      ["-B"]["--bootstrap"]
+      ("Resample each standard curve this many times and also write 95% intervals for efficiency, slope, intercept and copy numbers.")
+    | lyra::opt( bootstrap_seed, "1" )
+      ["--bootstrap-seed"]
+      ("Random seed for --bootstrap.")
+    | lyra::opt( manifest, "" ).optional()
+      ["-M"]["--manifest"]
+      ("Tab-separated file of chips to process, one per line: an 'input' column plus columns named after long options overriding them for that chip.")
+    | lyra::opt( profile_json, "" ).optional()
+      ["-p"]["--profile"]
+      ("Write per-chip stage timings and memory use to this JSON file.")
+    | lyra::opt( profile_trace, "" ).optional()
+      ["--trace"]
+      ("Write stage timings as a Chrome trace-event file.")
   ;
 
   // Check that the arguments where valid:
@@ -104,11 +230,79 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
-  // create input file array:
-  std::vector<std::string> inputs;
-  inputs = SmartchipInfra::create_file_array(input);
+  SmartchipSweep::grid thresholds;
+  robust_weight        robust_method;
+  SmartchipRules::rule_set qc_rules;
+  SmartchipStandards::definition standards;
+  std::uint32_t        exclude_mask = 0;
+  SmartchipOutliers::method outlier_test;
+  std::vector<SmartchipManifest::job> jobs;
+  SmartchipDiscover::options discovery;
+  SmartchipManifest::shared_resources resources;
+  try {
+    if (input.empty() == manifest.empty()) {
+      throw std::invalid_argument("give exactly one of --input or --manifest.");
+    }
+    if (!manifest.empty() && (aggregate || !stream_by.empty())) {
+      throw std::invalid_argument("--manifest cannot be combined with --stream-by or --aggregate.");
+    }
+    discovery.recursive = recursive;
+    if (!include_patterns.empty()) {discovery.patterns = string_split(include_patterns, ',');}
+    if (!qc_rules_path.empty()) {qc_rules.load(qc_rules_path);}
+    if (!standards_path.empty()) {standards.load(standards_path);}
+    robust_method = parse_robust_weight(robust);
+    outlier_test = SmartchipOutliers::parse_method(outliers);
+    SmartchipOutliers::validate(outlier_test, outlier_alpha);
+    if (!exclude_flags.empty()) {exclude_mask = SmartchipFlags::parse_mask(exclude_flags);}
+    SdsCompress::output_format = SdsCompress::parse_format(compress);
+    thresholds.efficiency_min = SmartchipSweep::parse_range(sweep_effmin, efficiency_min);
+    thresholds.efficiency_max = SmartchipSweep::parse_range(sweep_effmax, efficiency_max);
+    thresholds.r_squared      = SmartchipSweep::parse_range(sweep_rsquare, r_sqared_threshold);
+    if (aggregate && !stream_by.empty()) {
+      throw std::invalid_argument("--aggregate cannot be combined with --stream-by.");
+    }
+    if (aggregate && (spatial || outlier_test != SmartchipOutliers::method::none || robust_method != robust_weight::none)) {
+      throw std::invalid_argument("--spatial, --outliers and --robust cannot be combined with --aggregate.");
+    }
+    if (sweep && (aggregate || !stream_by.empty())) {
+      throw std::invalid_argument("--sweep cannot be combined with --stream-by or --aggregate.");
+    }
+    if (incremental && (sweep || aggregate || !stream_by.empty() || !manifest.empty())) {
+      throw std::invalid_argument("--incremental cannot be combined with --sweep, --stream-by, --aggregate or --manifest.");
+    }
+    if (resume && (aggregate || !stream_by.empty() || !manifest.empty())) {
+      throw std::invalid_argument("--resume cannot be combined with --stream-by, --aggregate or --manifest.");
+    }
+    if (resume && !input.empty() && !SmartchipDiscover::is_directory(input)) {
+      throw std::invalid_argument("--resume needs a directory --input; a single file is not journaled.");
+    }
+    if (audit && (sweep || aggregate)) {
+      throw std::invalid_argument("--audit cannot be combined with --sweep or --aggregate.");
+    }
+    if (bootstrap && (sweep || aggregate || !stream_by.empty())) {
+      throw std::invalid_argument("--bootstrap cannot be combined with --sweep, --stream-by or --aggregate.");
+    }
+    if (!manifest.empty()) {
+      jobs = SmartchipManifest::read_manifest(manifest);
+      // command line support files are shared like the manifest's own
+      for (auto& j : jobs) {
+        if (!gene_magnitudes.empty())  {j.settings.emplace("magnitudes", gene_magnitudes);}
+        if (!replacement_stds.empty()) {j.settings.emplace("replacements", replacement_stds);}
+      }
+      gene_magnitudes.clear();
+      replacement_stds.clear();
+      resources.load(jobs);
+    }
+  }
+  catch (const std::exception& e) {
+    std::cerr << "Error in command line: " << e.what() << std::endl;
+    return 1;
+  }
+  if (!profile_json.empty() || !profile_trace.empty()) {
+    SmartchipProfile::enable();
+  }
 
-  for (std::string input_file : inputs) {
+  auto configure = [&](const std::string& input_file) {
     SmartchipParameters sma(input_file);
     sma.set_replacement_stds(replacement_stds);
     sma.set_gene_magnitudes(gene_magnitudes);
@@ -125,9 +319,170 @@ int main(int argc, char *argv[]) {
     sma.set_efficiency_min(efficiency_min);
     sma.set_efficiency_max(efficiency_max);
     sma.set_r_sqared_threshold(r_sqared_threshold);
-    SmartchipAnalyzer sma_report(sma);
-    sma_report.build_reports();
+    sma.set_robust_method(robust_method);
+    sma.set_estimate_limits(limits);
+    sma.set_detection_ct(detection_ct);
+    sma.set_qc_rules(qc_rules);
+    sma.set_standards(standards);
+    sma.set_spatial(spatial);
+    sma.set_melt(melt);
+    sma.set_melt_tolerance(melt_tolerance);
+    sma.set_exclude_flags(exclude_mask);
+    sma.set_outlier_test(outlier_test);
+    sma.set_outlier_alpha(outlier_alpha);
+    sma.set_audit(audit);
+    return sma;
+  };
+
+  // one chip's reports, or its threshold sweep
+  auto run_chip = [&](SmartchipParameters params, unsigned int bootstrap_threads) {
+    if (sweep) {
+      SmartchipTransform sma(std::move(params));
+      SmartchipInfra::make_dir(sma.output_dir);
+      SmartchipSweep::write_report(sma.output_file, thresholds,
+        SmartchipSweep::evaluate(sma.extracted, sma.transformed, thresholds, sma.qc_rules));
+    } else {
+      SmartchipAnalyzer sma_report(std::move(params));
+      sma_report.build_reports();
+      if (bootstrap) {
+        SmartchipBootstrap::write_report(sma_report.output_file, sma_report.extracted,
+          sma_report.transformed, SmartchipBootstrap::run(sma_report, sma_report.extracted,
+          sma_report.transformed, bootstrap, bootstrap_seed, bootstrap_threads));
+      }
+    }
+  };
+
+  int status = 0;
+  std::mutex status_mutex;
+  auto report_error = [&](const std::string& file, const std::exception& e) {
+    std::lock_guard<std::mutex> lock(status_mutex);
+    std::cerr << "Error in '" << file << "': " << e.what() << std::endl;
+    status = 1;
+  };
+
+  if (!manifest.empty()) {
+    std::vector<SmartchipManifest::job_status> statuses(jobs.size());
+    {
+      ThreadPool pool(threads);
+      for (std::size_t i = 0; i < jobs.size(); ++i) {
+        pool.submit([&, i]() {
+          const SmartchipManifest::job& j = jobs[i];
+          SmartchipManifest::job_status& job_status = statuses[i];
+          job_status.line  = j.line;
+          job_status.input = j.input;
+          auto start = std::chrono::steady_clock::now();
+          try {
+            SmartchipArena::chip_scope arena;
+            SmartchipInfra::file_check(j.input);
+            SmartchipParameters params = configure(j.input);
+            SmartchipManifest::apply(params, j, resources);
+            SdsCompress::output_unit unit;
+            run_chip(std::move(params), 1);
+            unit.commit();
+            job_status.ok = true;
+          }
+          catch (const std::exception& e) {
+            job_status.message = e.what();
+            report_error(j.input, e);
+          }
+          job_status.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        });
+      }
+      pool.wait();
+    }
+    SmartchipManifest::write_status(SmartchipManifest::status_path(manifest), statuses);
+  } else {
+    if (!stream_by.empty()) {
+      for (std::string input_file : SmartchipDiscover::list(input, discovery, threads)) {
+        try {
+          SmartchipStream::process_archive(configure(input_file), stream_by);
+        }
+        catch (const std::exception& e) {report_error(input_file, e);}
+      }
+    } else if (aggregate) {
+      std::vector<std::string> inputs = SmartchipDiscover::list(input, discovery, threads);
+      std::vector<chip_reports> chips(inputs.size());
+      {
+        ThreadPool pool(threads);
+        for (std::size_t i = 0; i < inputs.size(); ++i) {
+          pool.submit([&, i]() {
+            try {
+              SmartchipArena::chip_scope arena;
+              SmartchipAnalyzer sma_report(configure(inputs[i]));
+              chips[i] = sma_report.collect_reports();
+            }
+            catch (const std::exception& e) {report_error(inputs[i], e);}
+          });
+        }
+        pool.wait();
+      }
+      chips.erase(std::remove_if(chips.begin(), chips.end(),
+        [](const chip_reports& c) {return c.chip.empty();}), chips.end());
+      std::string prefix = SmartchipInfra::batch_prefix(input, output);
+      SmartchipInfra::make_dir(prefix.substr(0, prefix.find_last_of("/\\") + 1));
+      try {
+        SdsCompress::output_unit unit;
+        create_consolidated_reports(prefix, chips);
+        unit.commit();
+      }
+      catch (const std::exception& e) {report_error(input, e);}
+    } else {
+      // chips are queued as the walk finds them, on the pool it runs on;
+      // only a single input file spreads its own assays over the threads
+      const bool single = !SmartchipDiscover::is_directory(input);
+      double support_time = -1;
+      for (const std::string& path : {gene_magnitudes, replacement_stds, qc_rules_path, standards_path}) {
+        if (incremental && !path.empty()) {support_time = std::max(support_time, SmartchipInfra::modified_time(path));}
+      }
+      // a directory batch journals its committed chips for --resume
+      SmartchipJournal::journal batch_journal;
+      if (!single) {
+        std::string prefix = SmartchipInfra::batch_prefix(input, output);
+        SmartchipInfra::make_dir(prefix.substr(0, prefix.find_last_of("/\\") + 1));
+        try {
+          batch_journal.open(prefix + "_journal.tsv", resume);
+        }
+        catch (const std::exception& e) {
+          report_error(input, e);
+          return status;
+        }
+      }
+      ThreadPool pool(threads);
+      SmartchipDiscover::found_file run_found = [&](const std::string& input_file, const std::string& relative) {
+        pool.submit([&, input_file, relative]() {
+          try {
+            // the worker's arena is reused from chip to chip
+            SmartchipArena::chip_scope arena;
+            SmartchipParameters params = configure(input_file);
+            // a directory --output mirrors the input tree
+            if (!relative.empty() && !output.empty() && params.output_file == params.output_dir + params.chip_name) {
+              params.set_output_dir(params.output_dir + relative + "/");
+            }
+            const double input_time = SmartchipInfra::modified_time(input_file);
+            if (resume && batch_journal.done(input_file, input_time)) {return;}
+            if (incremental && SmartchipInfra::reports_up_to_date(params.output_file,
+              std::max(support_time, input_time))) {return;}
+            // the chip's reports replace the old ones together, or not at all
+            SdsCompress::output_unit unit;
+            run_chip(std::move(params), single ? threads : 1);
+            unit.commit();
+            if (!single) {batch_journal.record(input_file, input_time);}
+          }
+          catch (const std::exception& e) {report_error(input_file, e);}
+        });
+      };
+      SmartchipDiscover::walk(pool, input, discovery, run_found);
+      pool.wait();
+      batch_journal.finish(status == 0);
+    }
+  }
+
+  if (!profile_json.empty()) {
+    SmartchipProfile::write_summary(profile_json);
+  }
+  if (!profile_trace.empty()) {
+    SmartchipProfile::write_trace(profile_trace);
   }
 
-	return(0);
+	return(status);
 }
\ No newline at end of file